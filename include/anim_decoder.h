@@ -0,0 +1,43 @@
+/*
+ * File:   anim_decoder.h
+ */
+
+#ifndef __ANIM_DECODER_H__
+#define	__ANIM_DECODER_H__
+
+#include <stdbool.h>
+
+/*
+ * Incremental decoder for animated GIF and APNG files. Frames are decoded one
+ * at a time, straight from the file, and composited onto a canvas the size of
+ * the whole animation. The canvas is stored as premultiplied RGBA bytes
+ * (ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE) so it can be copied into a bitmap as-is.
+ */
+typedef struct anim_decoder anim_decoder_t;
+
+enum {
+    ANIM_FRAME_ERROR    = -1,
+    ANIM_FRAME_END      = 0,
+    ANIM_FRAME_READY    = 1
+};
+
+bool anim_is_supported( const char* filename );
+
+anim_decoder_t* anim_open( const char* filename );
+
+int anim_get_width( const anim_decoder_t* anim );
+int anim_get_height( const anim_decoder_t* anim );
+
+/* Number of frames in the file, found without decoding any of them */
+int anim_get_frame_count( const anim_decoder_t* anim );
+
+/* Decode the next frame. On ANIM_FRAME_READY, "canvas" points to the
+ * composited frame (valid until the next call) and "delay_ms" holds the
+ * frame's display time. */
+int anim_next_frame(
+    anim_decoder_t* anim, const unsigned char** canvas, int* delay_ms
+);
+
+void anim_close( anim_decoder_t* anim );
+
+#endif	/* __ANIM_DECODER_H__ */
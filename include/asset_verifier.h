@@ -0,0 +1,27 @@
+/*
+ * File:   asset_verifier.h
+ */
+
+#ifndef __ASSET_VERIFIER_H__
+#define	__ASSET_VERIFIER_H__
+
+#include <stdbool.h>
+
+enum {
+    IMAGE_HEADER_MISSING    = -1,
+    IMAGE_HEADER_UNKNOWN    = 0,
+    IMAGE_HEADER_OK         = 1
+};
+
+/* Read the width and height from a PNG, BMP or TGA header without decoding
+ * any pixels */
+int read_image_size( const char* filename, int* width, int* height );
+
+/* Check every sprite config under "root" and the images they reference.
+ * Returns the number of problems found. */
+int verify_assets( const char* root, int num_threads );
+
+/* Entry point for "sprite_viewer --verify <directory> [--threads N]" */
+int verify_main( int argc, char** argv );
+
+#endif	/* __ASSET_VERIFIER_H__ */
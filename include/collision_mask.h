@@ -0,0 +1,63 @@
+/*
+ * File:   collision_mask.h
+ */
+
+#ifndef __COLLISION_MASK_H__
+#define	__COLLISION_MASK_H__
+
+#include "sprite_viewer.h"
+
+/*
+ * Collision mask sidecar (*.mask). All values are little-endian and every
+ * frame record starts on an 8-byte boundary so the file can be mapped and
+ * used in place.
+ *
+ *  Header (32 bytes):
+ *      char magic[4]       "SVMK"
+ *      u32  version        MASK_FILE_VERSION
+ *      u32  num_frames
+ *      u32  width, height  Frame size in pixels
+ *      u32  row_bytes      Bytes per mask row, a multiple of 8
+ *      u32  threshold      Pixels with alpha >= threshold are solid
+ *      u32  frame_size     Bytes per frame record
+ *
+ *  Frame record (repeated num_frames times):
+ *      i32  bounds[4]      min_x, min_y, max_x, max_y (max is exclusive)
+ *      u16  spans[height][2]   First solid x and last solid x + 1 per row
+ *      (zero padding up to an 8-byte boundary)
+ *      u8   bits[height][row_bytes]    1 bit per pixel, LSB is leftmost
+ *
+ * Empty bounds and spans are stored as zeroes.
+ */
+#define MASK_FILE_MAGIC     "SVMK"
+#define MASK_FILE_VERSION   1
+#define MASK_DEFAULT_THRESHOLD 128
+
+typedef struct {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+} mask_bounds_t;
+
+typedef struct {
+    unsigned short first;
+    unsigned short last;
+} mask_span_t;
+
+int get_mask_row_bytes( int width );
+
+/* Build the mask of the width*height area at (src_x, src_y) of "texture".
+ * "bits" must hold height*row_bytes bytes and "spans" must hold height
+ * entries. */
+bool build_collision_mask(
+    ALLEGRO_BITMAP* texture, int src_x, int src_y, int width, int height,
+    int threshold, int row_bytes,
+    unsigned char* bits, mask_span_t* spans, mask_bounds_t* bounds
+);
+
+bool save_collision_masks(
+    const char* filename, const sprite_t* sprite, int threshold
+);
+
+#endif	/* __COLLISION_MASK_H__ */
@@ -0,0 +1,47 @@
+/*
+ * File:   logger.h
+ */
+
+#ifndef __LOGGER_H__
+#define	__LOGGER_H__
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+/*
+ * Asynchronous logging. Messages are formatted by the calling thread into a
+ * fixed-size lock-free ring buffer and written out to the sinks by a
+ * background thread, so logging never waits on I/O or dialogs. If the ring
+ * is full the message is dropped and counted instead.
+ */
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_NOTICE,     /* Results the user asked for, such as a saved file */
+    LOG_WARNING,
+    LOG_ERROR
+} log_level_t;
+
+typedef enum {
+    LOG_SINK_STDERR,    /* Plain text on stderr */
+    LOG_SINK_FILE,      /* Plain text, appended to a file */
+    LOG_SINK_JSON,      /* One JSON object per line, appended to a file */
+    LOG_SINK_DIALOG     /* Native message boxes, see log_show_dialogs() */
+} log_sink_type_t;
+
+bool log_init( void );
+void log_shutdown( void );
+
+/* Sinks may be added at any time, "filename" is ignored unless it's needed */
+bool log_add_sink( log_sink_type_t type, log_level_t min_level, const char* filename );
+
+void log_write( log_level_t level, const char* str, ... );
+void log_write_v( log_level_t level, const char* str, va_list args );
+
+/* Show the message boxes queued for LOG_SINK_DIALOG. The log thread never
+ * opens them itself, so the main thread has to call this regularly. */
+void log_show_dialogs( void );
+
+const char* log_level_name( log_level_t level );
+
+#endif	/* __LOGGER_H__ */
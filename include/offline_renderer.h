@@ -0,0 +1,30 @@
+/*
+ * File:   offline_renderer.h
+ */
+
+#ifndef __OFFLINE_RENDERER_H__
+#define	__OFFLINE_RENDERER_H__
+
+#include "sprite_viewer.h"
+
+typedef enum {
+    RENDER_RAW, /* Packed RGBA frames on stdout */
+    RENDER_Y4M, /* YUV4MPEG2 (4:4:4) stream on stdout */
+    RENDER_PNG  /* Numbered PNG files */
+} render_format_t;
+
+typedef struct {
+    render_format_t format;
+    int fps;
+    int width;
+    int height;
+    int num_frames;     /* Zero renders exactly one loop of the animation */
+    const char* output; /* File name prefix for PNG sequences */
+} render_options_t;
+
+bool render_offline( const sprite_t* sprite, const render_options_t* options );
+
+/* Entry point for "sprite_viewer --render <file> [options]" */
+int render_main( int argc, char** argv );
+
+#endif	/* __OFFLINE_RENDERER_H__ */
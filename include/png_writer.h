@@ -0,0 +1,28 @@
+/*
+ * File:   png_writer.h
+ */
+
+#ifndef __PNG_WRITER_H__
+#define	__PNG_WRITER_H__
+
+#include <stdbool.h>
+
+/*
+ * Streaming PNG encoder for 8-bit RGBA images. Rows are filtered and
+ * compressed as they're written, so only a couple of rows and the 32KB
+ * deflate window are ever held in memory, however big the image is.
+ */
+typedef struct png_writer png_writer_t;
+
+png_writer_t* png_writer_open( const char* filename, int width, int height );
+
+/* Append "num_rows" rows of RGBA pixels, "pitch" bytes apart */
+bool png_writer_write_rows(
+    png_writer_t* png, const unsigned char* rows, int pitch, int num_rows
+);
+
+/* Finish the file. Fails if there was an I/O error or if fewer rows than the
+ * image's height were written. */
+bool png_writer_close( png_writer_t* png );
+
+#endif	/* __PNG_WRITER_H__ */
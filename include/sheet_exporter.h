@@ -12,5 +12,8 @@
 
 bool export_to_sheet( const sprite_t* );
 
+/* Minimum alpha (1-255) for a pixel to be solid in exported collision masks */
+void set_mask_threshold( int threshold );
+
 #endif	/* __SHEET_IO_H__ */
 
@@ -12,6 +12,12 @@
 
 sprite_t* load_sprite( ALLEGRO_PATH* path, ALLEGRO_CONFIG* cfg );
 
+sprite_t* load_sprite_file( ALLEGRO_PATH* path );
+
+sprite_t* load_animation( ALLEGRO_PATH* path );
+
+bool stream_sprite_frames( sprite_t* sprite, double time_limit );
+
 void destroy_sprite( sprite_t* sprite );
 
 #endif	/* __SPRITE_LOADER_H__ */
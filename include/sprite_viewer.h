@@ -20,7 +20,7 @@
 #endif
 
 #ifndef NEW_ARRAY
-    #define NEW_ARRAY( type, amount ) (type*)calloc( amount, sizeof(type)*amount )
+    #define NEW_ARRAY( type, amount ) (type*)calloc( amount, sizeof(type) )
 #endif
 
 #ifndef FREE_MEMORY
@@ -30,17 +30,58 @@
 /******************************************************************************
 		STRUCTURES
 ******************************************************************************/
+typedef struct {
+	int texture;    /* Index into sprite_t::textures */
+	int x;          /* Source rectangle within the texture */
+	int y;
+	int width;
+	int height;
+	int offset_x;   /* Where the frame is drawn, relative to the sprite */
+	int offset_y;
+	int duration;   /* Display time in milliseconds, 0 uses frame_delay */
+	int next_piece; /* Index into sprite_t::pieces, -1 if this is the last */
+} sprite_frame_t;
+
+/* Sprites are allocated as a single block, the texture, frame and piece
+ * tables follow the sprite_t header in the same allocation (see
+ * create_sprite). Frames which straddle the tiles of an oversized sheet are
+ * drawn from several pieces, chained together through next_piece. */
 typedef struct {
     bool is_sheet;
     bool use_alpha;
 	int num_frames;
+	int max_frames;
+	int num_textures;
+	int max_textures;
+	int num_pieces;
+	int max_pieces;
 	int frame_delay;
 	int width;
 	int height;
-	ALLEGRO_BITMAP** bitmap; /* Array of bitmaps */
+	int texture_format; /* TEXTURE_FORMAT_* mode, see texture_format.h */
+	ALLEGRO_BITMAP** textures;
+	sprite_frame_t* frames;
+	sprite_frame_t* pieces;
 	ALLEGRO_COLOR alpha;
+	struct anim_decoder* stream; /* Non-NULL while frames are still decoding */
 } sprite_t;
 
+/******************************************************************************
+		PLAYBACK (sprite_viewer.c)
+******************************************************************************/
+/* Number of timer ticks, minus one, that a frame stays on screen */
+int get_frame_delay( const sprite_t* sprite, int frame_num, int fps );
+
+/* Advance the animation by a single timer tick */
+void step_sprite(
+    const sprite_t* sprite, int fps, int* curr_frame, int* frame_iter
+);
+
+/* Draw a frame scaled to fit a target of the given size */
+void draw_sprite(
+    int target_width, int target_height, const sprite_t* sprite, int frame_num
+);
+
 /******************************************************************************
 		INLINE FUNCTIONS
 ******************************************************************************/
@@ -60,4 +101,10 @@ static inline float get_min_f( float x, float y ) {
 	return x < y ? x : y;
 }
 
+static inline const sprite_frame_t* get_next_piece(
+	const sprite_t* sprite, const sprite_frame_t* piece
+) {
+	return piece->next_piece < 0 ? NULL : &sprite->pieces[ piece->next_piece ];
+}
+
 #endif /* __SPRITE_VIEWER_H__ */
@@ -0,0 +1,44 @@
+/*
+ * File:   stress_test.h
+ */
+
+#ifndef __STRESS_TEST_H__
+#define	__STRESS_TEST_H__
+
+#include "sprite_viewer.h"
+
+typedef struct {
+    int num_instances;
+    int num_frames;     /* Frames which are measured */
+    int warmup_frames;  /* Frames drawn before measuring starts */
+    int fps;            /* Rate the instances are animated at */
+    int width;
+    int height;
+    bool headless;      /* Draw to a memory bitmap instead of a display */
+    const char* json;   /* Results as JSON to this file, "-" for stdout */
+} stress_options_t;
+
+typedef struct {
+    int num_frames;
+    double mean_ms;     /* Frame times */
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+    double draws_per_frame;     /* al_draw_bitmap_region() calls */
+    double batches_per_frame;   /* Texture changes, i.e. GPU draw calls */
+    double instances_per_ms;
+} stress_results_t;
+
+/* Draw every instance once per frame onto "target", sorted by texture and
+ * batched with al_hold_bitmap_drawing(). The display is flipped after each
+ * frame unless it's NULL. */
+bool run_stress_test(
+    const sprite_t* sprite, const stress_options_t* options,
+    ALLEGRO_BITMAP* target, ALLEGRO_DISPLAY* display, stress_results_t* results
+);
+
+/* Entry point for "sprite_viewer --stress <file> [options]" */
+int stress_main( int argc, char** argv );
+
+#endif	/* __STRESS_TEST_H__ */
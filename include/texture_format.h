@@ -0,0 +1,78 @@
+/*
+ * File:   texture_format.h
+ */
+
+#ifndef __TEXTURE_FORMAT_H__
+#define	__TEXTURE_FORMAT_H__
+
+#include <stdbool.h>
+#include <allegro5/allegro.h>
+
+/*
+ * Sprite textures are scanned once when they're loaded and stored in the
+ * smallest pixel format that can hold them. Set per sprite with
+ * "texture_format=" in the config, or for every sprite without one (such as
+ * GIF/APNG animations) with set_default_texture_format():
+ *
+ *  auto        Reduced formats with a bounded error: RGB565 for opaque
+ *              frames, RGBA5551 for color-keyed (binary alpha) frames and
+ *              RGBA4444 only when it is exact. Channels are rounded, so they
+ *              are off by at most 4 levels (2 for the green of RGB565).
+ *  exact       Reduced formats only when every pixel survives unchanged.
+ *  rgb565, rgba5551, rgba4444
+ *              Always use this format. Rounding errors of up to 8 levels
+ *              (RGBA4444), and RGB565 drops the alpha channel entirely.
+ *  rgba8888    Keep Allegro's default format.
+ */
+enum {
+    TEXTURE_FORMAT_AUTO = 0,
+    TEXTURE_FORMAT_EXACT,
+    TEXTURE_FORMAT_RGBA8888,
+    TEXTURE_FORMAT_RGB565,
+    TEXTURE_FORMAT_RGBA5551,
+    TEXTURE_FORMAT_RGBA4444
+};
+
+/* What a scan found out about a texture's pixels */
+typedef struct {
+    bool opaque;        /* Every alpha is 255 */
+    bool binary_alpha;  /* Every alpha is either 0 or 255 */
+    bool exact_565;     /* Colors survive RGB565 unchanged */
+    bool exact_5551;    /* Colors survive RGBA5551 unchanged (given binary alpha) */
+    bool exact_4444;    /* Colors and alpha survive RGBA4444 unchanged */
+} pixel_stats_t;
+
+/* Parse a "texture_format=" value, NULL or unknown values give "fallback" */
+int parse_texture_format( const char* value, int fallback );
+
+/* The mode given to sprites which don't set their own */
+void set_default_texture_format( int mode );
+int get_default_texture_format( void );
+
+/* Textures created between these share a few worker threads which scan
+ * large images. Batches may be nested, the workers stop with the last one. */
+void begin_texture_batch( void );
+void end_texture_batch( void );
+
+/* Scan ABGR_8888_LE pixels. Within a batch, large images are split across
+ * its workers; only one thread at a time may scan. */
+void scan_pixels(
+    const unsigned char* data, int pitch, int width, int height,
+    pixel_stats_t* stats
+);
+
+/* The ALLEGRO_PIXEL_FORMAT_* to store a texture in, or
+ * ALLEGRO_PIXEL_FORMAT_ANY to keep the default */
+int choose_pixel_format( const pixel_stats_t* stats, int mode );
+
+/* Create a texture from ABGR_8888_LE pixels, "pitch" bytes per row. In auto
+ * mode, memory bitmaps always keep the default format. */
+ALLEGRO_BITMAP* create_texture(
+    const unsigned char* pixels, int pitch, int width, int height, int mode
+);
+
+/* Move a loaded texture into a smaller format. Returns the new texture and
+ * destroys the old one, or returns "bitmap" if it's kept as it is. */
+ALLEGRO_BITMAP* compact_texture( ALLEGRO_BITMAP* bitmap, int mode );
+
+#endif	/* __TEXTURE_FORMAT_H__ */
@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 
+/* Shorthands for log_write(), messages are delivered asynchronously */
 void print_log( const char* str, ... );
 void print_err( const char* str, ... );
 void print_ok( const char* str, ... );
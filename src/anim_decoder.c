@@ -0,0 +1,960 @@
+
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_memfile.h>
+#include "sprite_viewer.h"
+#include "anim_decoder.h"
+
+/******************************************************************************
+        CONSTANTS
+ ******************************************************************************/
+enum { ANIM_TYPE_GIF, ANIM_TYPE_APNG };
+
+/* Frame disposal methods, shared between GIF and APNG */
+enum { DISPOSE_NONE, DISPOSE_BACKGROUND, DISPOSE_PREVIOUS };
+
+/* APNG blending methods */
+enum { BLEND_SOURCE, BLEND_OVER };
+
+static const unsigned char PNG_SIGNATURE[ 8 ] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+};
+
+/* Delays at or below this are treated the way web browsers treat them */
+static const int ANIM_MIN_DELAY     = 10;
+static const int ANIM_DEFAULT_DELAY = 100;
+
+/******************************************************************************
+        STRUCTURES
+ ******************************************************************************/
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} byte_buffer_t;
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    int dispose;
+} frame_rect_t;
+
+struct anim_decoder {
+    int type;
+    int width;
+    int height;
+    int num_frames;         /* Frames in the file, known before decoding */
+    int frames_decoded;
+    ALLEGRO_FILE* file;
+    unsigned char* canvas;  /* Premultiplied RGBA, width*height*4 bytes */
+    unsigned char* backup;  /* Canvas snapshot for DISPOSE_PREVIOUS */
+    frame_rect_t prev;      /* Last frame drawn, its disposal is still pending */
+    byte_buffer_t data;     /* Compressed data of the frame being decoded */
+
+    /* GIF */
+    unsigned char gif_palette[ 256*3 ];
+    unsigned char* gif_indices;
+    size_t gif_indices_size;
+
+    /* APNG */
+    bool png_animated;
+    bool png_have_fctl;
+    int png_blend;
+    int png_delay;
+    frame_rect_t png_rect;
+    unsigned char png_ihdr[ 13 ];
+    byte_buffer_t png_extra;    /* Chunks every frame needs (PLTE, tRNS...) */
+    byte_buffer_t png_frame;    /* Standalone PNG rebuilt for one frame */
+};
+
+/******************************************************************************
+        FORWARD DECLARATIONS
+ ******************************************************************************/
+static bool gif_open( anim_decoder_t* );
+static int gif_count_frames( ALLEGRO_FILE* );
+static int gif_next_frame( anim_decoder_t*, int* delay_ms );
+static bool png_open( anim_decoder_t* );
+static int png_count_frames( ALLEGRO_FILE* );
+static int png_next_frame( anim_decoder_t*, int* delay_ms );
+
+/******************************************************************************
+        BYTE BUFFERS
+ ******************************************************************************/
+static bool buffer_append(
+    byte_buffer_t* buf, const void* src, size_t amount
+) {
+    if ( buf->size + amount > buf->capacity ) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        unsigned char* data = NULL;
+
+        while ( capacity < buf->size + amount )
+            capacity *= 2;
+
+        data = (unsigned char*)realloc( buf->data, capacity );
+        if ( !data )
+            return false;
+
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+
+    if ( src )
+        memcpy( buf->data + buf->size, src, amount );
+    buf->size += amount;
+    return true;
+}
+
+static bool buffer_read( byte_buffer_t* buf, ALLEGRO_FILE* file, size_t amount ) {
+    size_t start = buf->size;
+
+    if ( !buffer_append( buf, NULL, amount ) )
+        return false;
+
+    return al_fread( file, buf->data + start, amount ) == amount;
+}
+
+static void buffer_free( byte_buffer_t* buf ) {
+    FREE_MEMORY( buf->data );
+    buf->size = buf->capacity = 0;
+}
+
+/******************************************************************************
+        FILE TYPE DETECTION
+ ******************************************************************************/
+static int anim_get_type( ALLEGRO_FILE* file ) {
+    unsigned char sig[ 8 ];
+
+    if ( al_fread( file, sig, sizeof( sig ) ) != sizeof( sig ) )
+        return -1;
+
+    if ( memcmp( sig, "GIF87a", 6 ) == 0 || memcmp( sig, "GIF89a", 6 ) == 0 ) {
+        al_fseek( file, 6, ALLEGRO_SEEK_SET );
+        return ANIM_TYPE_GIF;
+    }
+
+    if ( memcmp( sig, PNG_SIGNATURE, sizeof( PNG_SIGNATURE ) ) == 0 )
+        return ANIM_TYPE_APNG;
+
+    return -1;
+}
+
+bool anim_is_supported( const char* filename ) {
+    ALLEGRO_FILE* file = al_fopen( filename, "rb" );
+    int type = -1;
+
+    if ( !file )
+        return false;
+
+    type = anim_get_type( file );
+    al_fclose( file );
+
+    return type >= 0;
+}
+
+/******************************************************************************
+        OPENING AND CLOSING
+ ******************************************************************************/
+anim_decoder_t* anim_open( const char* filename ) {
+    bool ret = false;
+    anim_decoder_t* anim = NULL;
+    ALLEGRO_FILE* file = al_fopen( filename, "rb" );
+
+    if ( !file )
+        return NULL;
+
+    anim = (anim_decoder_t*)calloc( 1, sizeof( anim_decoder_t ) );
+    if ( !anim ) {
+        al_fclose( file );
+        return NULL;
+    }
+
+    anim->file = file;
+    anim->type = anim_get_type( file );
+
+    if ( anim->type == ANIM_TYPE_GIF ) {
+        ret = gif_open( anim );
+        anim->num_frames = gif_count_frames( file );
+    }
+    else if ( anim->type == ANIM_TYPE_APNG )
+        ret = png_open( anim );
+
+    /* Header sizes can't be trusted to fit in memory on 32-bit builds */
+    if ( ret && (size_t)anim->width > SIZE_MAX / 4 / (size_t)anim->height )
+        ret = false;
+
+    if ( ret ) {
+        size_t canvas_size = (size_t)anim->width * anim->height * 4;
+        /* Undrawn areas of the canvas start out fully transparent */
+        anim->canvas = (unsigned char*)calloc( canvas_size, 1 );
+        anim->backup = (unsigned char*)calloc( canvas_size, 1 );
+        ret = anim->canvas && anim->backup;
+    }
+
+    if ( !ret ) {
+        anim_close( anim );
+        return NULL;
+    }
+
+    return anim;
+}
+
+void anim_close( anim_decoder_t* anim ) {
+    if ( !anim )
+        return;
+
+    if ( anim->file )
+        al_fclose( anim->file );
+
+    buffer_free( &anim->data );
+    buffer_free( &anim->png_extra );
+    buffer_free( &anim->png_frame );
+    free( anim->gif_indices );
+    free( anim->canvas );
+    free( anim->backup );
+    free( anim );
+}
+
+int anim_get_width( const anim_decoder_t* anim ) {
+    return anim->width;
+}
+
+int anim_get_height( const anim_decoder_t* anim ) {
+    return anim->height;
+}
+
+int anim_get_frame_count( const anim_decoder_t* anim ) {
+    return anim->num_frames;
+}
+
+/******************************************************************************
+        FRAME COMPOSITING
+ ******************************************************************************/
+static int anim_clamp_delay( int delay_ms ) {
+    return delay_ms <= ANIM_MIN_DELAY ? ANIM_DEFAULT_DELAY : delay_ms;
+}
+
+/* The offsets and sizes are never negative, so comparing against what's left
+ * of the canvas can't overflow */
+static void clip_rect( const anim_decoder_t* anim, frame_rect_t* rect ) {
+    if ( rect->x >= anim->width || rect->y >= anim->height ) {
+        rect->width = rect->height = 0;
+        return;
+    }
+
+    rect->width = get_min_i( rect->width, anim->width - rect->x );
+    rect->height = get_min_i( rect->height, anim->height - rect->y );
+}
+
+/* Dispose of the previous frame, then prepare the canvas for "rect" */
+static void anim_begin_frame( anim_decoder_t* anim, const frame_rect_t* rect ) {
+    const frame_rect_t* prev = &anim->prev;
+    size_t stride = (size_t)anim->width * 4;
+
+    for ( int y = prev->y; y < prev->y + prev->height; ++y ) {
+        size_t offset = y*stride + prev->x*4;
+
+        if ( prev->dispose == DISPOSE_BACKGROUND )
+            memset( anim->canvas + offset, 0, prev->width*4 );
+        else if ( prev->dispose == DISPOSE_PREVIOUS )
+            memcpy( anim->canvas + offset, anim->backup + offset, prev->width*4 );
+    }
+
+    if ( rect->dispose == DISPOSE_PREVIOUS )
+        memcpy( anim->backup, anim->canvas, stride*anim->height );
+
+    anim->prev = *rect;
+    ++anim->frames_decoded;
+}
+
+int anim_next_frame(
+    anim_decoder_t* anim, const unsigned char** canvas, int* delay_ms
+) {
+    int ret = ANIM_FRAME_END;
+
+    if ( anim->type == ANIM_TYPE_GIF )
+        ret = gif_next_frame( anim, delay_ms );
+    else
+        ret = png_next_frame( anim, delay_ms );
+
+    if ( ret == ANIM_FRAME_READY ) {
+        *canvas = anim->canvas;
+        *delay_ms = anim_clamp_delay( *delay_ms );
+    }
+
+    return ret;
+}
+
+/******************************************************************************
+        GIF -- HEADER
+ ******************************************************************************/
+static bool gif_open( anim_decoder_t* anim ) {
+    unsigned char screen[ 7 ];
+
+    if ( al_fread( anim->file, screen, sizeof( screen ) ) != sizeof( screen ) )
+        return false;
+
+    anim->width = screen[ 0 ] | (screen[ 1 ] << 8);
+    anim->height = screen[ 2 ] | (screen[ 3 ] << 8);
+
+    /* Global color table */
+    if ( screen[ 4 ] & 0x80 ) {
+        size_t colors = 2 << (screen[ 4 ] & 0x07);
+        if ( al_fread( anim->file, anim->gif_palette, colors*3 ) != colors*3 )
+            return false;
+    }
+
+    return anim->width > 0 && anim->height > 0;
+}
+
+/* Read a chain of data sub-blocks, appending them to "buf" if it isn't NULL */
+static bool gif_read_sub_blocks( ALLEGRO_FILE* file, byte_buffer_t* buf ) {
+    int block_size = 0;
+
+    while ( (block_size = al_fgetc( file )) > 0 ) {
+        if ( buf ) {
+            if ( !buffer_read( buf, file, block_size ) )
+                return false;
+        }
+        else if ( !al_fseek( file, block_size, ALLEGRO_SEEK_CUR ) ) {
+            return false;
+        }
+    }
+
+    return block_size == 0;
+}
+
+/* Count the frames up front by skipping over all of the image data */
+static int gif_count_frames( ALLEGRO_FILE* file ) {
+    int64_t start = al_ftell( file );
+    int count = 0;
+    bool done = false;
+    unsigned char desc[ 9 ];
+
+    while ( !done ) {
+        switch ( al_fgetc( file ) ) {
+            case 0x21:
+                al_fgetc( file );
+                done = !gif_read_sub_blocks( file, NULL );
+                break;
+            case 0x2C:
+                if ( al_fread( file, desc, sizeof( desc ) ) != sizeof( desc ) ) {
+                    done = true;
+                    break;
+                }
+                if ( desc[ 8 ] & 0x80 )
+                    al_fseek( file, 3 * (2 << (desc[ 8 ] & 0x07)), ALLEGRO_SEEK_CUR );
+                al_fgetc( file );
+                done = !gif_read_sub_blocks( file, NULL );
+                count += !done;
+                break;
+            default:
+                done = true;
+                break;
+        }
+    }
+
+    al_fseek( file, start, ALLEGRO_SEEK_SET );
+    return count;
+}
+
+/******************************************************************************
+        GIF -- LZW DECOMPRESSION
+ ******************************************************************************/
+/* Returns the number of indices decoded, which is less than "out_size" when
+ * the data is truncated or corrupt */
+static size_t gif_decode_lzw(
+    const unsigned char* data, size_t data_size, int min_code_size,
+    unsigned char* out, size_t out_size
+) {
+    unsigned short prefix[ 4096 ];
+    unsigned char suffix[ 4096 ];
+    unsigned char stack[ 4097 ];
+    const int clear_code = 1 << min_code_size;
+    const int end_code = clear_code + 1;
+    int code_size = min_code_size + 1;
+    int next_code = clear_code + 2;
+    int prev_code = -1;
+    int first_char = 0;
+    uint32_t bits = 0;
+    int num_bits = 0;
+    size_t data_iter = 0;
+    size_t out_iter = 0;
+
+    for ( int i = 0; i < clear_code; ++i ) {
+        prefix[ i ] = 0;
+        suffix[ i ] = (unsigned char)i;
+    }
+
+    while ( out_iter < out_size ) {
+        int code = 0;
+        int in_code = 0;
+        int stack_size = 0;
+
+        /* Codes are packed least-significant bit first */
+        while ( num_bits < code_size ) {
+            if ( data_iter >= data_size )
+                return out_iter;
+            bits |= (uint32_t)data[ data_iter++ ] << num_bits;
+            num_bits += 8;
+        }
+        code = bits & ((1 << code_size) - 1);
+        bits >>= code_size;
+        num_bits -= code_size;
+
+        if ( code == clear_code ) {
+            code_size = min_code_size + 1;
+            next_code = clear_code + 2;
+            prev_code = -1;
+            continue;
+        }
+        if ( code == end_code )
+            return out_iter;
+
+        if ( prev_code < 0 ) {
+            if ( code >= clear_code )
+                return out_iter;
+            out[ out_iter++ ] = (unsigned char)code;
+            prev_code = first_char = code;
+            continue;
+        }
+
+        in_code = code;
+        if ( code >= next_code ) {
+            /* The "KwKwK" case, where a code is used as soon as it's made */
+            if ( code > next_code )
+                return out_iter;
+            stack[ stack_size++ ] = (unsigned char)first_char;
+            code = prev_code;
+        }
+
+        while ( code >= clear_code ) {
+            stack[ stack_size++ ] = suffix[ code ];
+            code = prefix[ code ];
+        }
+        first_char = code;
+        stack[ stack_size++ ] = (unsigned char)code;
+
+        if ( next_code < 4096 ) {
+            prefix[ next_code ] = (unsigned short)prev_code;
+            suffix[ next_code ] = (unsigned char)first_char;
+            if ( ++next_code == (1 << code_size) && code_size < 12 )
+                ++code_size;
+        }
+
+        while ( stack_size > 0 && out_iter < out_size )
+            out[ out_iter++ ] = stack[ --stack_size ];
+
+        prev_code = in_code;
+    }
+
+    return out_iter;
+}
+
+/******************************************************************************
+        GIF -- FRAME DECODING
+ ******************************************************************************/
+/* Map the n-th row of an interlaced image to its actual row */
+static int gif_interlaced_row( int row, int height ) {
+    int pass1 = (height + 7) / 8;
+    int pass2 = (height + 3) / 8;
+    int pass3 = (height + 1) / 4;
+
+    if ( row < pass1 )
+        return row * 8;
+    row -= pass1;
+    if ( row < pass2 )
+        return 4 + row * 8;
+    row -= pass2;
+    if ( row < pass3 )
+        return 2 + row * 4;
+    row -= pass3;
+    return 1 + row * 2;
+}
+
+static int gif_read_image( anim_decoder_t* anim, int transparent, int dispose ) {
+    unsigned char desc[ 9 ];
+    unsigned char local_palette[ 256*3 ];
+    const unsigned char* palette = anim->gif_palette;
+    bool interlaced = false;
+    int min_code_size = 0;
+    size_t num_pixels = 0;
+    size_t num_decoded = 0;
+    frame_rect_t rect;
+    ALLEGRO_FILE* file = anim->file;
+
+    if ( al_fread( file, desc, sizeof( desc ) ) != sizeof( desc ) )
+        return ANIM_FRAME_ERROR;
+
+    rect.x = desc[ 0 ] | (desc[ 1 ] << 8);
+    rect.y = desc[ 2 ] | (desc[ 3 ] << 8);
+    rect.width = desc[ 4 ] | (desc[ 5 ] << 8);
+    rect.height = desc[ 6 ] | (desc[ 7 ] << 8);
+    interlaced = (desc[ 8 ] & 0x40) != 0;
+
+    /* Local color table */
+    if ( desc[ 8 ] & 0x80 ) {
+        size_t colors = 2 << (desc[ 8 ] & 0x07);
+        memset( local_palette, 0, sizeof( local_palette ) );
+        if ( al_fread( file, local_palette, colors*3 ) != colors*3 )
+            return ANIM_FRAME_ERROR;
+        palette = local_palette;
+    }
+
+    min_code_size = al_fgetc( file );
+    if ( min_code_size < 2 || min_code_size > 11 )
+        return ANIM_FRAME_ERROR;
+
+    anim->data.size = 0;
+    if ( !gif_read_sub_blocks( file, &anim->data ) )
+        return ANIM_FRAME_ERROR;
+
+    /* Decompress the color indices. Pixels missing from truncated data are
+     * skipped like transparent ones, so the canvas shows through them. */
+    num_pixels = (size_t)rect.width * rect.height;
+    if ( num_pixels > anim->gif_indices_size ) {
+        free( anim->gif_indices );
+        anim->gif_indices = (unsigned char*)malloc( num_pixels );
+        anim->gif_indices_size = anim->gif_indices ? num_pixels : 0;
+        if ( !anim->gif_indices )
+            return ANIM_FRAME_ERROR;
+    }
+    num_decoded = gif_decode_lzw(
+        anim->data.data, anim->data.size, min_code_size,
+        anim->gif_indices, num_pixels
+    );
+
+    switch ( dispose ) {
+        case 2:  rect.dispose = DISPOSE_BACKGROUND; break;
+        case 3:  rect.dispose = DISPOSE_PREVIOUS;   break;
+        default: rect.dispose = DISPOSE_NONE;       break;
+    }
+
+    /* Draw the opaque pixels of this frame onto the canvas */
+    {
+        int width = rect.width;
+        int height = rect.height;
+
+        clip_rect( anim, &rect );
+        anim_begin_frame( anim, &rect );
+
+        for ( int row = 0; row < height; ++row ) {
+            int y = interlaced ? gif_interlaced_row( row, height ) : row;
+            size_t row_start = (size_t)row*width;
+            const unsigned char* src = anim->gif_indices + row_start;
+            unsigned char* dest = NULL;
+            int row_width = rect.width;
+
+            if ( y >= rect.height || row_start >= num_decoded )
+                continue;
+            if ( num_decoded - row_start < (size_t)row_width )
+                row_width = (int)(num_decoded - row_start);
+            dest = anim->canvas + ((size_t)(rect.y + y)*anim->width + rect.x)*4;
+
+            for ( int x = 0; x < row_width; ++x, dest += 4 ) {
+                const unsigned char* color = palette + src[ x ]*3;
+
+                if ( src[ x ] == transparent )
+                    continue;
+
+                dest[ 0 ] = color[ 0 ];
+                dest[ 1 ] = color[ 1 ];
+                dest[ 2 ] = color[ 2 ];
+                dest[ 3 ] = 255;
+            }
+        }
+    }
+
+    return ANIM_FRAME_READY;
+}
+
+static int gif_next_frame( anim_decoder_t* anim, int* delay_ms ) {
+    int transparent = -1;
+    int dispose = 0;
+    int label = 0;
+    ALLEGRO_FILE* file = anim->file;
+
+    *delay_ms = 0;
+
+    for ( ;; ) {
+        switch ( al_fgetc( file ) ) {
+            /* Extensions, only the graphic control extension matters here */
+            case 0x21:
+                label = al_fgetc( file );
+                anim->data.size = 0;
+                if ( !gif_read_sub_blocks( file, &anim->data ) )
+                    return ANIM_FRAME_ERROR;
+
+                if ( label == 0xF9 && anim->data.size >= 4 ) {
+                    const unsigned char* gce = anim->data.data;
+                    dispose = (gce[ 0 ] >> 2) & 0x07;
+                    transparent = (gce[ 0 ] & 0x01) ? gce[ 3 ] : -1;
+                    *delay_ms = (gce[ 1 ] | (gce[ 2 ] << 8)) * 10;
+                }
+                break;
+            /* Image descriptor */
+            case 0x2C:
+                return gif_read_image( anim, transparent, dispose );
+            /* Trailer, or a truncated file */
+            case 0x3B:
+            case EOF:
+                return ANIM_FRAME_END;
+            default:
+                return ANIM_FRAME_ERROR;
+        }
+    }
+}
+
+/******************************************************************************
+        APNG -- CHUNK I/O
+ ******************************************************************************/
+static uint32_t png_crc( const unsigned char* data, size_t size, uint32_t crc ) {
+    static uint32_t table[ 256 ];
+    static bool table_ready = false;
+
+    if ( !table_ready ) {
+        for ( uint32_t n = 0; n < 256; ++n ) {
+            uint32_t c = n;
+            for ( int k = 0; k < 8; ++k )
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[ n ] = c;
+        }
+        table_ready = true;
+    }
+
+    for ( size_t i = 0; i < size; ++i )
+        crc = table[ (crc ^ data[ i ]) & 0xFF ] ^ (crc >> 8);
+
+    return crc;
+}
+
+static uint32_t png_get_u32( const unsigned char* data ) {
+    return ((uint32_t)data[ 0 ] << 24) | ((uint32_t)data[ 1 ] << 16)
+        | ((uint32_t)data[ 2 ] << 8) | (uint32_t)data[ 3 ];
+}
+
+static void png_set_u32( unsigned char* data, uint32_t value ) {
+    data[ 0 ] = (unsigned char)(value >> 24);
+    data[ 1 ] = (unsigned char)(value >> 16);
+    data[ 2 ] = (unsigned char)(value >> 8);
+    data[ 3 ] = (unsigned char)value;
+}
+
+/* Read a chunk's length and type, leaving the file at the chunk's data */
+static bool png_read_chunk_header(
+    ALLEGRO_FILE* file, uint32_t* length, char type[ 5 ]
+) {
+    unsigned char header[ 8 ];
+
+    if ( al_fread( file, header, sizeof( header ) ) != sizeof( header ) )
+        return false;
+
+    *length = png_get_u32( header );
+    memcpy( type, header + 4, 4 );
+    type[ 4 ] = '\0';
+
+    return *length <= 0x7FFFFFFFu;
+}
+
+static bool png_skip_chunk( ALLEGRO_FILE* file, uint32_t length ) {
+    /* Skip the chunk data and its CRC */
+    return al_fseek( file, (int64_t)length + 4, ALLEGRO_SEEK_CUR );
+}
+
+static bool png_write_chunk(
+    byte_buffer_t* buf, const char* type,
+    const unsigned char* data, uint32_t length
+) {
+    unsigned char word[ 4 ];
+    uint32_t crc = 0xFFFFFFFFu;
+
+    crc = png_crc( (const unsigned char*)type, 4, crc );
+    crc = png_crc( data, length, crc );
+
+    png_set_u32( word, length );
+    if ( !buffer_append( buf, word, 4 ) || !buffer_append( buf, type, 4 ) )
+        return false;
+    if ( length && !buffer_append( buf, data, length ) )
+        return false;
+
+    png_set_u32( word, crc ^ 0xFFFFFFFFu );
+    return buffer_append( buf, word, 4 );
+}
+
+/******************************************************************************
+        APNG -- HEADER
+ ******************************************************************************/
+static bool png_open( anim_decoder_t* anim ) {
+    /* Chunks before the image data which every frame's PNG needs */
+    static const char* shared_chunks[] = {
+        "PLTE", "tRNS", "gAMA", "cHRM", "sRGB", "iCCP", "sBIT", NULL
+    };
+    bool have_ihdr = false;
+    uint32_t length = 0;
+    char type[ 5 ];
+    ALLEGRO_FILE* file = anim->file;
+
+    while ( png_read_chunk_header( file, &length, type ) ) {
+        if ( strcmp( type, "IHDR" ) == 0 ) {
+            if ( length != sizeof( anim->png_ihdr ) )
+                return false;
+            if ( al_fread( file, anim->png_ihdr, length ) != length )
+                return false;
+            al_fseek( file, 4, ALLEGRO_SEEK_CUR );
+            anim->width = (int)png_get_u32( anim->png_ihdr );
+            anim->height = (int)png_get_u32( anim->png_ihdr + 4 );
+            have_ihdr = true;
+            continue;
+        }
+
+        if ( strcmp( type, "acTL" ) == 0 && length == 8 ) {
+            unsigned char actl[ 8 ];
+            if ( al_fread( file, actl, sizeof( actl ) ) != sizeof( actl ) )
+                return false;
+            al_fseek( file, 4, ALLEGRO_SEEK_CUR );
+            anim->png_animated = true;
+            continue;
+        }
+
+        /* Stop at the first frame, png_next_frame() reads it from here */
+        if ( strcmp( type, "fcTL" ) == 0 || strcmp( type, "IDAT" ) == 0 ) {
+            al_fseek( file, -8, ALLEGRO_SEEK_CUR );
+            break;
+        }
+
+        for ( int i = 0; shared_chunks[ i ]; ++i ) {
+            if ( strcmp( type, shared_chunks[ i ] ) == 0 ) {
+                /* Copy the whole chunk, CRC included */
+                unsigned char header[ 8 ];
+                png_set_u32( header, length );
+                memcpy( header + 4, type, 4 );
+                if ( !buffer_append( &anim->png_extra, header, 8 ) )
+                    return false;
+                if ( !buffer_read( &anim->png_extra, file, length + 4 ) )
+                    return false;
+                length = 0;
+                break;
+            }
+        }
+
+        if ( length && !png_skip_chunk( file, length ) )
+            return false;
+    }
+
+    /* acTL's frame count sizes the frame table, so count the frames which
+     * are actually there instead of trusting it */
+    if ( anim->png_animated )
+        anim->num_frames = png_count_frames( file );
+
+    /* A still PNG is treated as a single frame covering the whole canvas */
+    if ( !anim->png_animated ) {
+        anim->num_frames = 1;
+        anim->png_have_fctl = true;
+        anim->png_rect.x = 0;
+        anim->png_rect.y = 0;
+        anim->png_rect.width = anim->width;
+        anim->png_rect.height = anim->height;
+        anim->png_rect.dispose = DISPOSE_NONE;
+        anim->png_blend = BLEND_SOURCE;
+        anim->png_delay = 0;
+    }
+
+    return have_ihdr && anim->width > 0 && anim->height > 0;
+}
+
+/* Count the fcTL chunks from the current position by skipping over the rest */
+static int png_count_frames( ALLEGRO_FILE* file ) {
+    int64_t start = al_ftell( file );
+    int count = 0;
+    uint32_t length = 0;
+    char type[ 5 ];
+
+    while ( png_read_chunk_header( file, &length, type )
+        && strcmp( type, "IEND" ) != 0
+    ) {
+        count += strcmp( type, "fcTL" ) == 0;
+        if ( !png_skip_chunk( file, length ) )
+            break;
+    }
+
+    al_fseek( file, start, ALLEGRO_SEEK_SET );
+    return count;
+}
+
+static bool png_read_fctl( anim_decoder_t* anim, uint32_t length ) {
+    unsigned char fctl[ 26 ];
+    int delay_num = 0;
+    int delay_den = 0;
+
+    if ( length != sizeof( fctl ) )
+        return false;
+    if ( al_fread( anim->file, fctl, sizeof( fctl ) ) != sizeof( fctl ) )
+        return false;
+    al_fseek( anim->file, 4, ALLEGRO_SEEK_CUR );
+
+    /* fctl[ 0..3 ] is the sequence number, which isn't needed */
+    anim->png_rect.width = (int)png_get_u32( fctl + 4 );
+    anim->png_rect.height = (int)png_get_u32( fctl + 8 );
+    anim->png_rect.x = (int)png_get_u32( fctl + 12 );
+    anim->png_rect.y = (int)png_get_u32( fctl + 16 );
+    delay_num = (fctl[ 20 ] << 8) | fctl[ 21 ];
+    delay_den = (fctl[ 22 ] << 8) | fctl[ 23 ];
+
+    switch ( fctl[ 24 ] ) {
+        case 1:  anim->png_rect.dispose = DISPOSE_BACKGROUND; break;
+        case 2:  anim->png_rect.dispose = DISPOSE_PREVIOUS;   break;
+        default: anim->png_rect.dispose = DISPOSE_NONE;       break;
+    }
+    anim->png_blend = fctl[ 25 ] == 1 ? BLEND_OVER : BLEND_SOURCE;
+
+    /* A zero denominator means the delay is in hundredths of a second */
+    if ( delay_den == 0 )
+        delay_den = 100;
+    anim->png_delay = delay_num * 1000 / delay_den;
+
+    anim->png_have_fctl = true;
+    return anim->png_rect.width > 0 && anim->png_rect.height > 0
+        && anim->png_rect.x >= 0 && anim->png_rect.y >= 0
+        && anim->png_rect.x <= INT_MAX - anim->png_rect.width
+        && anim->png_rect.y <= INT_MAX - anim->png_rect.height;
+}
+
+/******************************************************************************
+        APNG -- FRAME DECODING
+ ******************************************************************************/
+/* Wrap the collected frame data into a standalone PNG and decode it */
+static ALLEGRO_BITMAP* png_decode_frame( anim_decoder_t* anim ) {
+    unsigned char ihdr[ 13 ];
+    int bitmap_flags = al_get_new_bitmap_flags();
+    int bitmap_format = al_get_new_bitmap_format();
+    ALLEGRO_FILE* memfile = NULL;
+    ALLEGRO_BITMAP* bitmap = NULL;
+    byte_buffer_t* png = &anim->png_frame;
+
+    memcpy( ihdr, anim->png_ihdr, sizeof( ihdr ) );
+    png_set_u32( ihdr, anim->png_rect.width );
+    png_set_u32( ihdr + 4, anim->png_rect.height );
+
+    png->size = 0;
+    if (   !buffer_append( png, PNG_SIGNATURE, sizeof( PNG_SIGNATURE ) )
+        || !png_write_chunk( png, "IHDR", ihdr, sizeof( ihdr ) )
+        || !buffer_append( png, anim->png_extra.data, anim->png_extra.size )
+        || !png_write_chunk( png, "IDAT", anim->data.data, anim->data.size )
+        || !png_write_chunk( png, "IEND", NULL, 0 )
+    ) {
+        return NULL;
+    }
+
+    /* Decode into system memory, the pixels are composited on the CPU */
+    al_set_new_bitmap_flags( ALLEGRO_MEMORY_BITMAP );
+    al_set_new_bitmap_format( ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE );
+
+    memfile = al_open_memfile( png->data, png->size, "r" );
+    if ( memfile ) {
+        bitmap = al_load_bitmap_f( memfile, ".png" );
+        al_fclose( memfile );
+    }
+
+    al_set_new_bitmap_flags( bitmap_flags );
+    al_set_new_bitmap_format( bitmap_format );
+
+    return bitmap;
+}
+
+static bool png_composite_frame( anim_decoder_t* anim, ALLEGRO_BITMAP* frame ) {
+    frame_rect_t rect = anim->png_rect;
+    ALLEGRO_LOCKED_REGION* lock = NULL;
+
+    /* The first frame can't restore to a previous frame which doesn't exist */
+    if ( anim->frames_decoded == 0 && rect.dispose == DISPOSE_PREVIOUS )
+        rect.dispose = DISPOSE_BACKGROUND;
+
+    lock = al_lock_bitmap(
+        frame, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+    if ( !lock )
+        return false;
+
+    clip_rect( anim, &rect );
+    anim_begin_frame( anim, &rect );
+
+    /* Allegro loads PNGs with premultiplied alpha, as the canvas is stored */
+    for ( int y = 0; y < rect.height; ++y ) {
+        const unsigned char* src = (const unsigned char*)lock->data + y*lock->pitch;
+        unsigned char* dest =
+            anim->canvas + ((size_t)(rect.y + y)*anim->width + rect.x)*4;
+
+        if ( anim->png_blend == BLEND_SOURCE ) {
+            memcpy( dest, src, rect.width*4 );
+            continue;
+        }
+
+        for ( int x = 0; x < rect.width*4; x += 4 ) {
+            int inv_alpha = 255 - src[ x + 3 ];
+            for ( int c = 0; c < 4; ++c )
+                dest[ x + c ] = src[ x + c ] + (dest[ x + c ]*inv_alpha + 127)/255;
+        }
+    }
+
+    al_unlock_bitmap( frame );
+    return true;
+}
+
+static int png_next_frame( anim_decoder_t* anim, int* delay_ms ) {
+    bool ret = false;
+    uint32_t length = 0;
+    char type[ 5 ];
+    ALLEGRO_FILE* file = anim->file;
+    ALLEGRO_BITMAP* frame = NULL;
+
+    anim->data.size = 0;
+
+    /* Gather the image data up until the next frame begins */
+    while ( png_read_chunk_header( file, &length, type ) ) {
+        if ( strcmp( type, "fcTL" ) == 0 ) {
+            if ( anim->data.size > 0 ) {
+                al_fseek( file, -8, ALLEGRO_SEEK_CUR );
+                break;
+            }
+            if ( !png_read_fctl( anim, length ) )
+                return ANIM_FRAME_ERROR;
+        }
+        else if ( strcmp( type, "IDAT" ) == 0 && anim->png_have_fctl ) {
+            if ( !buffer_read( &anim->data, file, length ) )
+                return ANIM_FRAME_ERROR;
+            al_fseek( file, 4, ALLEGRO_SEEK_CUR );
+        }
+        else if ( strcmp( type, "fdAT" ) == 0 && anim->png_have_fctl ) {
+            /* Same as IDAT, but prefixed with a sequence number */
+            if ( length < 4 || !al_fseek( file, 4, ALLEGRO_SEEK_CUR ) )
+                return ANIM_FRAME_ERROR;
+            if ( !buffer_read( &anim->data, file, length - 4 ) )
+                return ANIM_FRAME_ERROR;
+            al_fseek( file, 4, ALLEGRO_SEEK_CUR );
+        }
+        else if ( strcmp( type, "IEND" ) == 0 ) {
+            break;
+        }
+        else if ( !png_skip_chunk( file, length ) ) {
+            return ANIM_FRAME_ERROR;
+        }
+    }
+
+    if ( anim->data.size == 0 )
+        return ANIM_FRAME_END;
+
+    frame = png_decode_frame( anim );
+    if ( !frame )
+        return ANIM_FRAME_ERROR;
+
+    ret = png_composite_frame( anim, frame );
+    al_destroy_bitmap( frame );
+
+    anim->png_have_fctl = false;
+    *delay_ms = anim->png_delay;
+
+    return ret ? ANIM_FRAME_READY : ANIM_FRAME_ERROR;
+}
@@ -0,0 +1,443 @@
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <allegro5/allegro.h>
+#include "sprite_viewer.h"
+#include "util_functions.h"
+#include "logger.h"
+#include "asset_verifier.h"
+
+/* Defines, since VERIFY_MAX_THREADS sizes the thread array */
+#define VERIFY_THREADS 8
+#define VERIFY_MAX_THREADS 64
+
+/* Enough bytes for the PNG IHDR and the BMP info header */
+#define IMAGE_HEADER_SIZE 32
+
+/******************************************************************************
+ *      STRUCTURES
+ ******************************************************************************/
+typedef struct {
+    int config;         /* Index of the config which references the file */
+    char* filename;
+    bool is_sheet;      /* Sheets only need to be at least this big */
+    int expected_width;
+    int expected_height;
+    int status;         /* IMAGE_HEADER_* result */
+    int width;
+    int height;
+} verify_job_t;
+
+typedef struct {
+    char** configs;
+    int num_configs;
+    verify_job_t* jobs;
+    size_t num_jobs;
+    size_t max_jobs;
+    atomic_size_t next_job;
+    int num_problems;
+    int num_skipped;    /* Images in formats whose headers aren't read */
+} verify_queue_t;
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+bool collect_configs( verify_queue_t*, ALLEGRO_FS_ENTRY* dir );
+void collect_config_files( verify_queue_t*, const char* filename );
+void report_problem( verify_queue_t*, const char* filename, const char* str, ... );
+
+/******************************************************************************
+ *      IMAGE HEADERS
+ ******************************************************************************/
+static int get_u16_le( const unsigned char* data ) {
+    return data[ 0 ] | (data[ 1 ] << 8);
+}
+
+static int get_s32_le( const unsigned char* data ) {
+    return (int)( data[ 0 ] | (data[ 1 ] << 8) | (data[ 2 ] << 16)
+        | ((unsigned)data[ 3 ] << 24) );
+}
+
+static int get_s32_be( const unsigned char* data ) {
+    return (int)( ((unsigned)data[ 0 ] << 24) | (data[ 1 ] << 16)
+        | (data[ 2 ] << 8) | data[ 3 ] );
+}
+
+static bool has_extension( const char* filename, const char* ext ) {
+    size_t name_len = strlen( filename );
+    size_t ext_len = strlen( ext );
+
+    if ( name_len < ext_len )
+        return false;
+
+    filename += name_len - ext_len;
+    while ( *ext ) {
+        if ( tolower( (unsigned char)*filename++ ) != *ext++ )
+            return false;
+    }
+    return true;
+}
+
+int read_image_size( const char* filename, int* width, int* height ) {
+    unsigned char header[ IMAGE_HEADER_SIZE ];
+    size_t size = 0;
+    FILE* file = fopen( filename, "rb" );
+
+    if ( !file )
+        return IMAGE_HEADER_MISSING;
+
+    /* Only the first few bytes of each file are ever read */
+    size = fread( header, 1, sizeof( header ), file );
+    fclose( file );
+
+    /* PNG: the signature is followed by the IHDR chunk */
+    if ( size >= 24 && memcmp( header, "\x89PNG\r\n\x1A\n", 8 ) == 0
+        && memcmp( header + 12, "IHDR", 4 ) == 0
+    ) {
+        *width = get_s32_be( header + 16 );
+        *height = get_s32_be( header + 20 );
+        return IMAGE_HEADER_OK;
+    }
+
+    /* BMP: OS/2 core headers use 16-bit sizes, bottom-up images are negative */
+    if ( size >= 26 && header[ 0 ] == 'B' && header[ 1 ] == 'M' ) {
+        if ( get_s32_le( header + 14 ) == 12 ) {
+            *width = get_u16_le( header + 18 );
+            *height = get_u16_le( header + 20 );
+        }
+        else {
+            *width = get_s32_le( header + 18 );
+            *height = abs( get_s32_le( header + 22 ) );
+        }
+        return IMAGE_HEADER_OK;
+    }
+
+    /* TGA has no signature, so go by the extension */
+    if ( size >= 18 && has_extension( filename, ".tga" ) ) {
+        *width = get_u16_le( header + 12 );
+        *height = get_u16_le( header + 14 );
+        return IMAGE_HEADER_OK;
+    }
+
+    return IMAGE_HEADER_UNKNOWN;
+}
+
+/******************************************************************************
+ *      PROBLEM REPORTING
+ ******************************************************************************/
+void report_problem(
+    verify_queue_t* queue, const char* filename, const char* str, ...
+) {
+    va_list args;
+
+    print_msg( "%s: ", filename );
+    va_start( args, str );
+        vfprintf( stdout, str, args );
+    va_end( args );
+    print_msg( "\n" );
+
+    ++queue->num_problems;
+}
+
+/******************************************************************************
+ *      CONFIG SCANNING
+ ******************************************************************************/
+static verify_job_t* add_job( verify_queue_t* queue ) {
+    if ( queue->num_jobs == queue->max_jobs ) {
+        size_t max_jobs = queue->max_jobs ? queue->max_jobs*2 : 1024;
+        verify_job_t* jobs = (verify_job_t*)realloc(
+            queue->jobs, max_jobs*sizeof( verify_job_t )
+        );
+        if ( !jobs )
+            return NULL;
+        queue->jobs = jobs;
+        queue->max_jobs = max_jobs;
+    }
+
+    return &queue->jobs[ queue->num_jobs++ ];
+}
+
+static char* copy_string( const char* str ) {
+    size_t size = strlen( str ) + 1;
+    char* copy = (char*)malloc( size );
+
+    if ( copy )
+        memcpy( copy, str, size );
+    return copy;
+}
+
+static int get_config_int( ALLEGRO_CONFIG* cfg, const char* section, const char* key ) {
+    const char* value = al_get_config_value( cfg, section, key );
+    return value ? atoi( value ) : -1;
+}
+
+/* Report a value the loader can't do without */
+static bool require_value(
+    verify_queue_t* queue, ALLEGRO_CONFIG* cfg, const char* filename,
+    const char* section, const char* key
+) {
+    if ( al_get_config_value( cfg, section, key ) )
+        return true;
+
+    if ( section )
+        report_problem( queue, filename, "missing [%s] %s", section, key );
+    else
+        report_problem( queue, filename, "missing %s", key );
+    return false;
+}
+
+/* Queue up every image referenced by a config, checking what can be checked
+ * without opening them */
+void collect_config_files( verify_queue_t* queue, const char* filename ) {
+    int config = queue->num_configs;
+    int num_files = 0;
+    int is_sheet = 0;
+    int use_alpha = 0;
+    int num_frames = 0;
+    int width = 0;
+    int height = 0;
+    bool has_size = false;
+    const char* entry = NULL;
+    char** configs = NULL;
+    ALLEGRO_CONFIG_ENTRY* cfg_iter = NULL;
+    ALLEGRO_CONFIG* cfg = al_load_config_file( filename );
+    ALLEGRO_PATH* path = NULL;
+
+    if ( !cfg ) {
+        report_problem( queue, filename, "unable to parse the config" );
+        return;
+    }
+
+    configs = (char**)realloc( queue->configs, (config + 1)*sizeof( char* ) );
+    if ( !configs ) {
+        al_destroy_config( cfg );
+        return;
+    }
+    queue->configs = configs;
+    queue->configs[ config ] = copy_string( filename );
+    ++queue->num_configs;
+
+    is_sheet = get_config_int( cfg, NULL, "is_sheet" );
+    use_alpha = get_config_int( cfg, NULL, "use_alpha" );
+    num_frames = get_config_int( cfg, NULL, "num_frames" );
+    width = get_config_int( cfg, "SIZE", "width" );
+    height = get_config_int( cfg, "SIZE", "height" );
+
+    /* load_sprite() reads all of these without checking they exist */
+    require_value( queue, cfg, filename, NULL, "is_sheet" );
+    require_value( queue, cfg, filename, NULL, "frame_delay" );
+    require_value( queue, cfg, filename, NULL, "use_alpha" );
+    has_size = require_value( queue, cfg, filename, "SIZE", "width" );
+    has_size = require_value( queue, cfg, filename, "SIZE", "height" ) && has_size;
+
+    if ( has_size && (width < 1 || height < 1) )
+        report_problem( queue, filename, "invalid [SIZE] %ix%i", width, height );
+    if ( is_sheet > 0 && require_value( queue, cfg, filename, NULL, "num_frames" )
+        && num_frames < 1
+    ) {
+        report_problem( queue, filename, "sheets need num_frames, found %i", num_frames );
+    }
+    if ( use_alpha > 0 ) {
+        require_value( queue, cfg, filename, "ALPHA", "r" );
+        require_value( queue, cfg, filename, "ALPHA", "g" );
+        require_value( queue, cfg, filename, "ALPHA", "b" );
+    }
+
+    path = al_create_path( filename );
+
+    for ( entry = al_get_first_config_entry( cfg, "FILES", &cfg_iter );
+          entry;
+          entry = al_get_next_config_entry( &cfg_iter )
+    ) {
+        verify_job_t* job = add_job( queue );
+        if ( !job )
+            break;
+
+        al_set_path_filename( path, al_get_config_value( cfg, "FILES", entry ) );
+        job->config = config;
+        job->filename = copy_string( al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP ) );
+        job->is_sheet = is_sheet > 0;
+        /* Sheets hold every frame side by side */
+        job->expected_width = job->is_sheet ? width*num_frames : width;
+        job->expected_height = height;
+        job->status = IMAGE_HEADER_UNKNOWN;
+        job->width = job->height = 0;
+        ++num_files;
+
+        /* Only the first file of a sheet is ever loaded */
+        if ( job->is_sheet )
+            break;
+    }
+
+    if ( num_files == 0 )
+        report_problem( queue, filename, "no files listed under [FILES]" );
+    else if ( is_sheet == 0 && num_frames > 0 && num_frames != num_files )
+        report_problem( queue, filename,
+            "num_frames is %i, but [FILES] lists %i frames", num_frames, num_files
+        );
+
+    al_destroy_path( path );
+    al_destroy_config( cfg );
+}
+
+bool collect_configs( verify_queue_t* queue, ALLEGRO_FS_ENTRY* dir ) {
+    ALLEGRO_FS_ENTRY* entry = NULL;
+
+    if ( !al_open_directory( dir ) )
+        return false;
+
+    while ( (entry = al_read_directory( dir )) ) {
+        const char* name = al_get_fs_entry_name( entry );
+
+        if ( al_get_fs_entry_mode( entry ) & ALLEGRO_FILEMODE_ISDIR )
+            collect_configs( queue, entry );
+        else if ( has_extension( name, ".ini" ) )
+            collect_config_files( queue, name );
+
+        al_destroy_fs_entry( entry );
+    }
+
+    al_close_directory( dir );
+    return true;
+}
+
+/******************************************************************************
+ *      IMAGE CHECKING
+ ******************************************************************************/
+static void* verify_thread( ALLEGRO_THREAD* thread, void* arg ) {
+    verify_queue_t* queue = (verify_queue_t*)arg;
+    (void)thread;
+
+    for ( ;; ) {
+        size_t i = atomic_fetch_add( &queue->next_job, 1 );
+        verify_job_t* job = NULL;
+
+        if ( i >= queue->num_jobs )
+            break;
+
+        job = &queue->jobs[ i ];
+        job->status = read_image_size( job->filename, &job->width, &job->height );
+    }
+
+    return NULL;
+}
+
+static void report_job( verify_queue_t* queue, const verify_job_t* job ) {
+    const char* config = queue->configs[ job->config ];
+
+    if ( job->status == IMAGE_HEADER_MISSING ) {
+        report_problem( queue, config, "missing file %s", job->filename );
+    }
+    else if ( job->status == IMAGE_HEADER_UNKNOWN ) {
+        /* Allegro may still load it, so this isn't a problem */
+        print_msg( "%s: header not checked for %s\n", config, job->filename );
+        ++queue->num_skipped;
+    }
+    else if ( job->is_sheet ) {
+        if ( job->width < job->expected_width || job->height < job->expected_height )
+            report_problem( queue, config,
+                "sheet %s is %ix%i, too small for %ix%i",
+                job->filename, job->width, job->height,
+                job->expected_width, job->expected_height
+            );
+    }
+    else if ( job->width != job->expected_width || job->height != job->expected_height ) {
+        report_problem( queue, config,
+            "frame %s is %ix%i, but [SIZE] is %ix%i",
+            job->filename, job->width, job->height,
+            job->expected_width, job->expected_height
+        );
+    }
+}
+
+/******************************************************************************
+ *      VERIFICATION
+ ******************************************************************************/
+int verify_assets( const char* root, int num_threads ) {
+    double start_time = al_get_time();
+    ALLEGRO_THREAD* threads[ VERIFY_MAX_THREADS ];
+    ALLEGRO_FS_ENTRY* dir = al_create_fs_entry( root );
+    verify_queue_t queue;
+
+    memset( &queue, 0, sizeof( queue ) );
+    atomic_init( &queue.next_job, 0 );
+    num_threads = get_max_i( get_min_i( num_threads, VERIFY_MAX_THREADS ), 1 );
+
+    if ( !dir || !collect_configs( &queue, dir ) ) {
+        print_err( "Unable to open the directory %s.", root );
+        if ( dir )
+            al_destroy_fs_entry( dir );
+        return 1;
+    }
+    al_destroy_fs_entry( dir );
+
+    /* Read the image headers in parallel, this is where the I/O time goes */
+    for ( int i = 0; i < num_threads; ++i ) {
+        threads[ i ] = al_create_thread( verify_thread, &queue );
+        if ( threads[ i ] )
+            al_start_thread( threads[ i ] );
+    }
+    for ( int i = 0; i < num_threads; ++i ) {
+        if ( threads[ i ] ) {
+            al_join_thread( threads[ i ], NULL );
+            al_destroy_thread( threads[ i ] );
+        }
+    }
+    /* Covers any threads which couldn't be created */
+    verify_thread( NULL, &queue );
+
+    for ( size_t i = 0; i < queue.num_jobs; ++i ) {
+        report_job( &queue, &queue.jobs[ i ] );
+        free( queue.jobs[ i ].filename );
+    }
+    for ( int i = 0; i < queue.num_configs; ++i )
+        free( queue.configs[ i ] );
+
+    print_log(
+        "Checked %i configs and %u images in %.3f seconds, %i problems found, "\
+        "%i images skipped.",
+        queue.num_configs, (unsigned)queue.num_jobs,
+        al_get_time() - start_time, queue.num_problems, queue.num_skipped
+    );
+
+    free( queue.jobs );
+    free( queue.configs );
+
+    return queue.num_problems;
+}
+
+/******************************************************************************
+ *      COMMAND LINE
+ ******************************************************************************/
+int verify_main( int argc, char** argv ) {
+    const char* root = NULL;
+    int num_threads = VERIFY_THREADS;
+
+    for ( int i = 2; i < argc; ++i ) {
+        if ( strcmp( argv[ i ], "--threads" ) == 0 && i + 1 < argc )
+            num_threads = atoi( argv[ ++i ] );
+        else
+            root = argv[ i ];
+    }
+
+    if ( !root ) {
+        fprintf( stderr, "Usage: sprite_viewer --verify <directory> [--threads N]\n" );
+        return 1;
+    }
+
+    if ( !al_init() ) {
+        fprintf( stderr, "Unable to initialize Allegro.\n" );
+        return 1;
+    }
+    if ( !log_init() ) {
+        fprintf( stderr, "Unable to start the logger.\n" );
+        return 1;
+    }
+    log_add_sink( LOG_SINK_STDERR, LOG_INFO, NULL );
+
+    return verify_assets( root, num_threads ) > 0 ? 1 : 0;
+}
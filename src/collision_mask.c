@@ -0,0 +1,239 @@
+
+#include <string.h>
+#include <allegro5/allegro.h>
+#include "sprite_viewer.h"
+#include "util_functions.h"
+#include "collision_mask.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define MASK_USE_SSE2
+    #include <emmintrin.h>
+#endif
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+void pack_mask_row( const unsigned char*, int width, int threshold, unsigned char* );
+void find_mask_span( const unsigned char*, int row_bytes, mask_span_t* );
+
+/******************************************************************************
+ *      MASK LAYOUT
+ ******************************************************************************/
+int get_mask_row_bytes( int width ) {
+    /* Pad rows out to whole 64-bit words */
+    return ((width + 63) / 64) * 8;
+}
+
+static size_t align_8( size_t size ) {
+    return (size + 7) & ~(size_t)7;
+}
+
+/******************************************************************************
+ *      MASK GENERATION -- BIT PACKING
+ ******************************************************************************/
+/* Pack one row of ABGR_8888_LE pixels into "bits", which must be zeroed */
+void pack_mask_row(
+    const unsigned char* pixels, int width, int threshold, unsigned char* bits
+) {
+    int x = 0;
+
+#ifdef MASK_USE_SSE2
+    const __m128i limit = _mm_set1_epi8( (char)threshold );
+
+    /* 16 pixels at a time, the alpha of each lands in one movemask bit */
+    for ( ; x + 16 <= width; x += 16 ) {
+        const __m128i* src = (const __m128i*)( pixels + x*4 );
+        __m128i a0 = _mm_srli_epi32( _mm_loadu_si128( src + 0 ), 24 );
+        __m128i a1 = _mm_srli_epi32( _mm_loadu_si128( src + 1 ), 24 );
+        __m128i a2 = _mm_srli_epi32( _mm_loadu_si128( src + 2 ), 24 );
+        __m128i a3 = _mm_srli_epi32( _mm_loadu_si128( src + 3 ), 24 );
+        __m128i alpha = _mm_packus_epi16(
+            _mm_packs_epi32( a0, a1 ), _mm_packs_epi32( a2, a3 )
+        );
+        /* Unsigned alpha >= threshold */
+        __m128i solid = _mm_cmpeq_epi8( _mm_max_epu8( alpha, limit ), alpha );
+        int mask = _mm_movemask_epi8( solid );
+
+        bits[ x/8 ] = (unsigned char)mask;
+        bits[ x/8 + 1 ] = (unsigned char)( mask >> 8 );
+    }
+#endif
+
+    for ( ; x < width; ++x ) {
+        if ( pixels[ x*4 + 3 ] >= threshold )
+            bits[ x/8 ] |= (unsigned char)( 1 << (x & 7) );
+    }
+}
+
+/******************************************************************************
+ *      MASK GENERATION -- ROW SPANS
+ ******************************************************************************/
+void find_mask_span( const unsigned char* bits, int row_bytes, mask_span_t* span ) {
+    int first = 0;
+    int last = row_bytes - 1;
+
+    span->first = span->last = 0;
+
+    while ( first < row_bytes && !bits[ first ] )
+        ++first;
+    if ( first == row_bytes )
+        return;
+
+    while ( !bits[ last ] )
+        --last;
+
+    span->first = (unsigned short)( first*8 );
+    for ( int b = bits[ first ]; !(b & 1); b >>= 1 )
+        ++span->first;
+
+    span->last = (unsigned short)( last*8 );
+    for ( int b = bits[ last ]; b; b >>= 1 )
+        ++span->last;
+}
+
+/******************************************************************************
+ *      MASK GENERATION
+ ******************************************************************************/
+bool build_collision_mask(
+    ALLEGRO_BITMAP* texture, int src_x, int src_y, int width, int height,
+    int threshold, int row_bytes,
+    unsigned char* bits, mask_span_t* spans, mask_bounds_t* bounds
+) {
+    int pixel_width = get_min_i( width, al_get_bitmap_width( texture ) - src_x );
+    int pixel_height = get_min_i( height, al_get_bitmap_height( texture ) - src_y );
+    ALLEGRO_LOCKED_REGION* lock = NULL;
+
+    memset( bits, 0, (size_t)height*row_bytes );
+    memset( spans, 0, height*sizeof( mask_span_t ) );
+    memset( bounds, 0, sizeof( mask_bounds_t ) );
+
+    /* A frame entirely outside of its texture is simply empty */
+    if ( pixel_width < 1 || pixel_height < 1 )
+        return true;
+
+    lock = al_lock_bitmap_region(
+        texture, src_x, src_y, pixel_width, pixel_height,
+        ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+    if ( !lock )
+        return false;
+
+    bounds->min_x = width;
+    bounds->min_y = height;
+
+    for ( int y = 0; y < pixel_height; ++y ) {
+        unsigned char* row = bits + (size_t)y*row_bytes;
+
+        pack_mask_row(
+            (const unsigned char*)lock->data + y*lock->pitch,
+            pixel_width, threshold, row
+        );
+        find_mask_span( row, row_bytes, &spans[ y ] );
+
+        if ( spans[ y ].last > 0 ) {
+            bounds->min_x = get_min_i( bounds->min_x, spans[ y ].first );
+            bounds->max_x = get_max_i( bounds->max_x, spans[ y ].last );
+            bounds->min_y = get_min_i( bounds->min_y, y );
+            bounds->max_y = y + 1;
+        }
+    }
+
+    al_unlock_bitmap( texture );
+
+    /* Nothing solid in the frame */
+    if ( bounds->max_y == 0 )
+        memset( bounds, 0, sizeof( mask_bounds_t ) );
+
+    return true;
+}
+
+/******************************************************************************
+ *      MASK EXPORTING
+ ******************************************************************************/
+static unsigned char* put_u16( unsigned char* dest, unsigned value ) {
+    dest[ 0 ] = (unsigned char)value;
+    dest[ 1 ] = (unsigned char)( value >> 8 );
+    return dest + 2;
+}
+
+static unsigned char* put_u32( unsigned char* dest, unsigned value ) {
+    dest = put_u16( dest, value & 0xFFFF );
+    return put_u16( dest, value >> 16 );
+}
+
+bool save_collision_masks(
+    const char* filename, const sprite_t* sprite, int threshold
+) {
+    bool ret = true;
+    int row_bytes = get_mask_row_bytes( sprite->width );
+    size_t spans_size = align_8( (size_t)sprite->height*4 );
+    size_t frame_size = 16 + spans_size + (size_t)sprite->height*row_bytes;
+    unsigned char header[ 32 ];
+    unsigned char* record = NULL;
+    mask_span_t* spans = NULL;
+    mask_bounds_t bounds;
+    FILE* file = NULL;
+
+    threshold = get_max_i( get_min_i( threshold, 255 ), 1 );
+
+    record = (unsigned char*)malloc( frame_size );
+    spans = (mask_span_t*)calloc( sprite->height, sizeof( mask_span_t ) );
+    file = fopen( filename, "wb" );
+
+    if ( !record || !spans || !file ) {
+        print_err( "Unable to save the collision masks to %s.", filename );
+        free( record );
+        free( spans );
+        if ( file )
+            fclose( file );
+        return false;
+    }
+
+    memcpy( header, MASK_FILE_MAGIC, 4 );
+    put_u32( header + 4, MASK_FILE_VERSION );
+    put_u32( header + 8, sprite->num_frames );
+    put_u32( header + 12, sprite->width );
+    put_u32( header + 16, sprite->height );
+    put_u32( header + 20, row_bytes );
+    put_u32( header + 24, threshold );
+    put_u32( header + 28, (unsigned)frame_size );
+    ret = fwrite( header, sizeof( header ), 1, file ) == 1;
+
+    /* Only sheets are ever split into pieces, and sheets aren't exported,
+     * so each frame here is whole */
+    for ( int i = 0; i < sprite->num_frames && ret; ++i ) {
+        const sprite_frame_t* f = &sprite->frames[ i ];
+        unsigned char* dest = record;
+
+        memset( record, 0, frame_size );
+        ret = build_collision_mask(
+            sprite->textures[ f->texture ], f->x, f->y,
+            sprite->width, sprite->height, threshold,
+            row_bytes, record + 16 + spans_size, spans, &bounds
+        );
+
+        dest = put_u32( dest, bounds.min_x );
+        dest = put_u32( dest, bounds.min_y );
+        dest = put_u32( dest, bounds.max_x );
+        dest = put_u32( dest, bounds.max_y );
+        for ( int y = 0; y < sprite->height; ++y ) {
+            dest = put_u16( dest, spans[ y ].first );
+            dest = put_u16( dest, spans[ y ].last );
+        }
+
+        ret = ret && fwrite( record, frame_size, 1, file ) == 1;
+    }
+
+    ret = (fclose( file ) == 0) && ret;
+    free( record );
+    free( spans );
+
+    if ( !ret ) {
+        print_err(
+            "An I/O error occurred while saving the collision masks to %s.",
+            filename
+        );
+    }
+
+    return ret;
+}
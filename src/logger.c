@@ -0,0 +1,416 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_native_dialog.h>
+#include "logger.h"
+
+/******************************************************************************
+ *      CONSTANTS
+ ******************************************************************************/
+#define LOG_RING_SIZE       256 /* Must be a power of two */
+#define LOG_MESSAGE_SIZE    512
+#define LOG_MAX_SINKS       8
+#define LOG_MAX_DIALOGS     16
+
+/* How long the log thread sleeps when there's nothing to write */
+static const double LOG_IDLE_TIME = 0.005;
+
+/******************************************************************************
+ *      STRUCTURES
+ ******************************************************************************/
+typedef struct {
+    atomic_size_t sequence;
+    log_level_t level;
+    double time;
+    char text[ LOG_MESSAGE_SIZE ];
+} log_slot_t;
+
+typedef struct {
+    log_level_t level;
+    char text[ LOG_MESSAGE_SIZE ];
+} log_dialog_t;
+
+typedef struct {
+    log_sink_type_t type;
+    log_level_t min_level;
+    FILE* file;
+} log_sink_t;
+
+/******************************************************************************
+ *      GLOBAL VARIABLES
+ ******************************************************************************/
+/* Bounded multi-producer queue, the log thread is the only consumer */
+static log_slot_t ring[ LOG_RING_SIZE ];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;
+static atomic_uint dropped_messages;
+static atomic_bool running;
+
+static ALLEGRO_THREAD* log_thread = NULL;
+static ALLEGRO_MUTEX* sink_mutex = NULL;
+static log_sink_t sinks[ LOG_MAX_SINKS ];
+static int num_sinks = 0;
+
+/* Dialog messages waiting for the main thread, also guarded by sink_mutex */
+static log_dialog_t dialogs[ LOG_MAX_DIALOGS ];
+static int first_dialog = 0;
+static int num_dialogs = 0;
+
+/******************************************************************************
+ *      LEVEL NAMES
+ ******************************************************************************/
+const char* log_level_name( log_level_t level ) {
+    switch ( level ) {
+        case LOG_DEBUG:     return "debug";
+        case LOG_INFO:      return "info";
+        case LOG_NOTICE:    return "notice";
+        case LOG_WARNING:   return "warning";
+        case LOG_ERROR:     return "error";
+    }
+    return "unknown";
+}
+
+/******************************************************************************
+ *      SINK OUTPUT
+ ******************************************************************************/
+static void write_text( FILE* file, const log_slot_t* msg ) {
+    fprintf( file, "[%10.3f] %-7s %s\n", msg->time, log_level_name( msg->level ), msg->text );
+}
+
+static void write_json( FILE* file, const log_slot_t* msg ) {
+    fprintf( file, "{\"time\":%.6f,\"level\":\"%s\",\"message\":\"",
+        msg->time, log_level_name( msg->level )
+    );
+
+    for ( const char* c = msg->text; *c; ++c ) {
+        switch ( *c ) {
+            case '"':   fputs( "\\\"", file ); break;
+            case '\\':  fputs( "\\\\", file ); break;
+            case '\n':  fputs( "\\n", file );  break;
+            case '\r':  fputs( "\\r", file );  break;
+            case '\t':  fputs( "\\t", file );  break;
+            default:
+                if ( (unsigned char)*c < 0x20 )
+                    fprintf( file, "\\u%04x", *c );
+                else
+                    fputc( *c, file );
+        }
+    }
+
+    fputs( "\"}\n", file );
+}
+
+static void show_dialog( const log_dialog_t* msg ) {
+    const char* title = "Information";
+    const char* heading = "Information";
+    int flags = 0;
+
+    if ( msg->level == LOG_ERROR ) {
+        title = "Error";
+        heading = "Runtime Error";
+        flags = ALLEGRO_MESSAGEBOX_ERROR;
+    }
+    else if ( msg->level == LOG_WARNING ) {
+        title = heading = "Warning";
+        flags = ALLEGRO_MESSAGEBOX_WARN;
+    }
+    else if ( msg->level == LOG_NOTICE ) {
+        title = "Success";
+        heading = "Program Success";
+        flags = ALLEGRO_MESSAGEBOX_WARN;
+    }
+
+    al_show_native_message_box( NULL, title, heading, msg->text, NULL, flags );
+}
+
+/* Message boxes are modal and can't be opened off the main thread on every
+ * platform, so they're queued here for log_show_dialogs() instead. Once the
+ * queue is full, further dialogs only reach the other sinks. */
+static void queue_dialog( const log_slot_t* msg ) {
+    log_dialog_t* dialog = NULL;
+
+    al_lock_mutex( sink_mutex );
+    if ( num_dialogs < LOG_MAX_DIALOGS ) {
+        dialog = &dialogs[ (first_dialog + num_dialogs) % LOG_MAX_DIALOGS ];
+        dialog->level = msg->level;
+        memcpy( dialog->text, msg->text, sizeof( dialog->text ) );
+        ++num_dialogs;
+    }
+    al_unlock_mutex( sink_mutex );
+}
+
+static void log_dispatch( const log_slot_t* msg ) {
+    log_sink_t active[ LOG_MAX_SINKS ];
+    int num_active = 0;
+
+    /* Work from a copy so that nothing is written while the lock is held */
+    al_lock_mutex( sink_mutex );
+    num_active = num_sinks;
+    memcpy( active, sinks, num_sinks*sizeof( log_sink_t ) );
+    al_unlock_mutex( sink_mutex );
+
+    for ( int i = 0; i < num_active; ++i ) {
+        log_sink_t* sink = &active[ i ];
+
+        if ( msg->level < sink->min_level )
+            continue;
+
+        switch ( sink->type ) {
+            case LOG_SINK_STDERR:
+                write_text( stderr, msg );
+                break;
+            case LOG_SINK_FILE:
+                write_text( sink->file, msg );
+                fflush( sink->file );
+                break;
+            case LOG_SINK_JSON:
+                write_json( sink->file, msg );
+                fflush( sink->file );
+                break;
+            case LOG_SINK_DIALOG:
+                queue_dialog( msg );
+                break;
+        }
+    }
+}
+
+void log_show_dialogs( void ) {
+    log_dialog_t dialog;
+
+    if ( !sink_mutex )
+        return;
+
+    for ( ;; ) {
+        al_lock_mutex( sink_mutex );
+        if ( num_dialogs == 0 ) {
+            al_unlock_mutex( sink_mutex );
+            return;
+        }
+        dialog = dialogs[ first_dialog ];
+        first_dialog = (first_dialog + 1) % LOG_MAX_DIALOGS;
+        --num_dialogs;
+        al_unlock_mutex( sink_mutex );
+
+        show_dialog( &dialog );
+    }
+}
+
+/******************************************************************************
+ *      RING BUFFER
+ ******************************************************************************/
+static void ring_reset( void ) {
+    for ( size_t i = 0; i < LOG_RING_SIZE; ++i )
+        atomic_store_explicit( &ring[ i ].sequence, i, memory_order_relaxed );
+
+    atomic_store( &enqueue_pos, 0 );
+    dequeue_pos = 0;
+}
+
+/* Claim a free slot, or return NULL if the ring is full */
+static log_slot_t* ring_claim( size_t* pos_out ) {
+    size_t pos = atomic_load_explicit( &enqueue_pos, memory_order_relaxed );
+
+    for ( ;; ) {
+        log_slot_t* slot = &ring[ pos & (LOG_RING_SIZE - 1) ];
+        size_t seq = atomic_load_explicit( &slot->sequence, memory_order_acquire );
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if ( diff == 0 ) {
+            if ( atomic_compare_exchange_weak_explicit(
+                &enqueue_pos, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed
+            ) ) {
+                *pos_out = pos;
+                return slot;
+            }
+        }
+        else if ( diff < 0 ) {
+            return NULL;
+        }
+        else {
+            pos = atomic_load_explicit( &enqueue_pos, memory_order_relaxed );
+        }
+    }
+}
+
+/* Copy out the oldest message, only ever called by a single consumer */
+static bool ring_pop( log_slot_t* msg ) {
+    log_slot_t* slot = &ring[ dequeue_pos & (LOG_RING_SIZE - 1) ];
+    size_t seq = atomic_load_explicit( &slot->sequence, memory_order_acquire );
+
+    if ( seq != dequeue_pos + 1 )
+        return false;
+
+    msg->level = slot->level;
+    msg->time = slot->time;
+    memcpy( msg->text, slot->text, sizeof( msg->text ) );
+
+    atomic_store_explicit(
+        &slot->sequence, dequeue_pos + LOG_RING_SIZE, memory_order_release
+    );
+    ++dequeue_pos;
+    return true;
+}
+
+static bool log_drain( void ) {
+    bool ret = false;
+    unsigned dropped = atomic_exchange( &dropped_messages, 0 );
+    log_slot_t msg;
+
+    while ( ring_pop( &msg ) ) {
+        log_dispatch( &msg );
+        ret = true;
+    }
+
+    if ( dropped ) {
+        msg.level = LOG_WARNING;
+        msg.time = al_get_time();
+        snprintf( msg.text, sizeof( msg.text ),
+            "%u log messages were dropped because the log was full.", dropped
+        );
+        log_dispatch( &msg );
+    }
+
+    return ret;
+}
+
+/******************************************************************************
+ *      LOG THREAD
+ ******************************************************************************/
+static void* log_thread_proc( ALLEGRO_THREAD* thread, void* arg ) {
+    (void)arg;
+
+    while ( !al_get_thread_should_stop( thread ) ) {
+        if ( !log_drain() )
+            al_rest( LOG_IDLE_TIME );
+    }
+
+    log_drain();
+    return NULL;
+}
+
+/******************************************************************************
+ *      INITIALIZATION
+ ******************************************************************************/
+bool log_init( void ) {
+    static bool registered = false;
+
+    if ( atomic_load( &running ) )
+        return true;
+
+    if ( !sink_mutex )
+        sink_mutex = al_create_mutex();
+
+    ring_reset();
+    log_thread = al_create_thread( log_thread_proc, NULL );
+    if ( !sink_mutex || !log_thread )
+        return false;
+
+    atomic_store( &running, true );
+    al_start_thread( log_thread );
+
+    /* Flush whatever is left when the program exits */
+    if ( !registered ) {
+        atexit( log_shutdown );
+        registered = true;
+    }
+
+    return true;
+}
+
+void log_shutdown( void ) {
+    if ( !atomic_exchange( &running, false ) )
+        return;
+
+    al_join_thread( log_thread, NULL );
+    al_destroy_thread( log_thread );
+    log_thread = NULL;
+
+    /* Catch anything queued while the thread was stopping */
+    log_drain();
+
+    al_lock_mutex( sink_mutex );
+    for ( int i = 0; i < num_sinks; ++i ) {
+        if ( sinks[ i ].file )
+            fclose( sinks[ i ].file );
+    }
+    num_sinks = 0;
+    al_unlock_mutex( sink_mutex );
+}
+
+bool log_add_sink(
+    log_sink_type_t type, log_level_t min_level, const char* filename
+) {
+    FILE* file = NULL;
+
+    if ( !sink_mutex && !(sink_mutex = al_create_mutex()) )
+        return false;
+
+    if ( type == LOG_SINK_FILE || type == LOG_SINK_JSON ) {
+        file = filename ? fopen( filename, "a" ) : NULL;
+        if ( !file )
+            return false;
+    }
+
+    al_lock_mutex( sink_mutex );
+    if ( num_sinks == LOG_MAX_SINKS ) {
+        al_unlock_mutex( sink_mutex );
+        if ( file )
+            fclose( file );
+        return false;
+    }
+
+    sinks[ num_sinks ].type = type;
+    sinks[ num_sinks ].min_level = min_level;
+    sinks[ num_sinks ].file = file;
+    ++num_sinks;
+    al_unlock_mutex( sink_mutex );
+
+    return true;
+}
+
+/******************************************************************************
+ *      WRITING MESSAGES
+ ******************************************************************************/
+void log_write_v( log_level_t level, const char* str, va_list args ) {
+    size_t pos = 0;
+    size_t length = 0;
+    log_slot_t* slot = NULL;
+
+    /* Without the log thread, there's nothing to hand the message to */
+    if ( !atomic_load( &running ) ) {
+        fprintf( stderr, "%-7s ", log_level_name( level ) );
+        vfprintf( stderr, str, args );
+        fputc( '\n', stderr );
+        return;
+    }
+
+    slot = ring_claim( &pos );
+    if ( !slot ) {
+        atomic_fetch_add( &dropped_messages, 1 );
+        return;
+    }
+
+    slot->level = level;
+    slot->time = al_get_time();
+    vsnprintf( slot->text, sizeof( slot->text ), str, args );
+
+    /* Sinks add their own line endings */
+    length = strlen( slot->text );
+    while ( length > 0 && slot->text[ length - 1 ] == '\n' )
+        slot->text[ --length ] = '\0';
+
+    atomic_store_explicit( &slot->sequence, pos + 1, memory_order_release );
+}
+
+void log_write( log_level_t level, const char* str, ... ) {
+    va_list args;
+
+    va_start( args, str );
+        log_write_v( level, str, args );
+    va_end( args );
+}
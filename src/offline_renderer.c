@@ -0,0 +1,322 @@
+
+#include <string.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_image.h>
+#include "sprite_viewer.h"
+#include "sprite_loader.h"
+#include "util_functions.h"
+#include "logger.h"
+#include "texture_format.h"
+#include "offline_renderer.h"
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+static const int RENDER_FPS = 60;
+static const char* RENDER_PREFIX = "frame";
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+int count_loop_ticks( const sprite_t*, int fps );
+bool write_raw_frame( ALLEGRO_BITMAP*, FILE* );
+bool write_y4m_frame( ALLEGRO_BITMAP*, unsigned char* planes, FILE* );
+
+/******************************************************************************
+ *      FRAME COUNTING
+ ******************************************************************************/
+/* Number of timer ticks in one full loop of the animation */
+int count_loop_ticks( const sprite_t* sprite, int fps ) {
+    int ticks = 0;
+
+    for ( int i = 0; i < sprite->num_frames; ++i )
+        ticks += get_frame_delay( sprite, i, fps ) + 1;
+
+    return ticks;
+}
+
+/******************************************************************************
+ *      FRAME OUTPUT -- RAW RGBA
+ ******************************************************************************/
+bool write_raw_frame( ALLEGRO_BITMAP* target, FILE* file ) {
+    int width = al_get_bitmap_width( target );
+    int height = al_get_bitmap_height( target );
+    bool ret = true;
+    ALLEGRO_LOCKED_REGION* lock = al_lock_bitmap(
+        target, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+
+    if ( !lock )
+        return false;
+
+    for ( int y = 0; y < height && ret; ++y ) {
+        const char* row = (const char*)lock->data + y*lock->pitch;
+        ret = fwrite( row, 4, width, file ) == (size_t)width;
+    }
+
+    al_unlock_bitmap( target );
+    return ret;
+}
+
+/******************************************************************************
+ *      FRAME OUTPUT -- YUV4MPEG2
+ ******************************************************************************/
+bool write_y4m_frame(
+    ALLEGRO_BITMAP* target, unsigned char* planes, FILE* file
+) {
+    int width = al_get_bitmap_width( target );
+    int height = al_get_bitmap_height( target );
+    size_t plane_size = (size_t)width * height;
+    unsigned char* y_plane = planes;
+    unsigned char* u_plane = planes + plane_size;
+    unsigned char* v_plane = planes + plane_size*2;
+    ALLEGRO_LOCKED_REGION* lock = al_lock_bitmap(
+        target, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+
+    if ( !lock )
+        return false;
+
+    /* Full-range BT.601 in 8.8 fixed point, so the output is bit-exact */
+    for ( int y = 0; y < height; ++y ) {
+        const unsigned char* src = (const unsigned char*)lock->data + y*lock->pitch;
+
+        for ( int x = 0; x < width; ++x, src += 4 ) {
+            int r = src[ 0 ];
+            int g = src[ 1 ];
+            int b = src[ 2 ];
+
+            *y_plane++ = (unsigned char)((77*r + 150*g + 29*b + 128) >> 8);
+            *u_plane++ = (unsigned char)((-43*r - 85*g + 128*b + 32896) >> 8);
+            *v_plane++ = (unsigned char)((128*r - 107*g - 21*b + 32896) >> 8);
+        }
+    }
+
+    al_unlock_bitmap( target );
+
+    fputs( "FRAME\n", file );
+    return fwrite( planes, 1, plane_size*3, file ) == plane_size*3;
+}
+
+/******************************************************************************
+ *      RENDERING
+ ******************************************************************************/
+bool render_offline( const sprite_t* sprite, const render_options_t* options ) {
+    bool ret            = true;
+    int curr_frame      = 0;
+    int frame_iter      = 0;
+    int fps             = options->fps > 0 ? options->fps : RENDER_FPS;
+    int width           = options->width > 0 ? options->width : sprite->width;
+    int height          = options->height > 0 ? options->height : sprite->height;
+    int num_frames      = options->num_frames;
+    int bitmap_flags    = al_get_new_bitmap_flags();
+    double start_time   = al_get_time();
+    double elapsed      = 0.0;
+    unsigned char* planes = NULL;
+    ALLEGRO_BITMAP* target = NULL;
+
+    if ( num_frames < 1 )
+        num_frames = count_loop_ticks( sprite, fps );
+
+    /* Render in system memory, there might not be a GPU at all */
+    al_set_new_bitmap_flags( ALLEGRO_MEMORY_BITMAP );
+    target = al_create_bitmap( width, height );
+    al_set_new_bitmap_flags( bitmap_flags );
+
+    if ( !target ) {
+        print_err( "Unable to create a %ix%i render target.", width, height );
+        return false;
+    }
+
+    if ( options->format == RENDER_Y4M ) {
+        planes = (unsigned char*)malloc( (size_t)width*height*3 );
+        if ( !planes ) {
+            al_destroy_bitmap( target );
+            return false;
+        }
+        /* Players assume limited range unless told, write_y4m_frame() is full */
+        fprintf(
+            stdout, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C444 XCOLORRANGE=FULL\n",
+            width, height, fps
+        );
+    }
+
+    al_set_target_bitmap( target );
+
+    /* Step and draw exactly as do_main_loop() does, once per timer tick */
+    for ( int i = 0; i < num_frames && ret; ++i ) {
+        al_clear_to_color( al_map_rgb( 255, 255, 255 ) );
+        draw_sprite( width, height, sprite, curr_frame );
+
+        switch ( options->format ) {
+            case RENDER_RAW:
+                ret = write_raw_frame( target, stdout );
+                break;
+            case RENDER_Y4M:
+                ret = write_y4m_frame( target, planes, stdout );
+                break;
+            case RENDER_PNG: {
+                char filename[ 1024 ];
+                snprintf(
+                    filename, sizeof( filename ), "%s%05i.png",
+                    options->output ? options->output : RENDER_PREFIX, i
+                );
+                ret = al_save_bitmap( filename, target );
+                break;
+            }
+        }
+
+        step_sprite( sprite, fps, &curr_frame, &frame_iter );
+    }
+
+    fflush( stdout );
+
+    /* Log the throughput, stdout may be carrying the video */
+    elapsed = al_get_time() - start_time;
+    print_log(
+        "Rendered %i frames (%ix%i) in %.3f seconds, %.1f fps, %.1fx real time\n",
+        num_frames, width, height, elapsed,
+        num_frames / get_max_f( elapsed, 1e-6 ),
+        num_frames / (double)fps / get_max_f( elapsed, 1e-6 )
+    );
+    if ( !ret )
+        print_err( "An I/O error occurred while writing the frames." );
+
+    free( planes );
+    al_destroy_bitmap( target );
+
+    return ret;
+}
+
+/******************************************************************************
+ *      COMMAND LINE
+ ******************************************************************************/
+static void print_render_usage( void ) {
+    fprintf( stderr,
+        "Usage: sprite_viewer --render <file> [options]\n"\
+        "  --format raw|y4m|png  Output format (default: y4m on stdout)\n"\
+        "  --fps N               Playback rate to step the animation at\n"\
+        "  --size WxH            Output size (default: the sprite size)\n"\
+        "  --frames N            Frame count (default: one full loop)\n"\
+        "  --output PREFIX       File name prefix for PNG sequences\n"\
+        "  --texture-format F    Texture format for sprites without their own\n"\
+        "                        (default: exact source pixels)\n"\
+        "  --log-json FILE       Also write the log as JSON lines to FILE\n"
+    );
+}
+
+int render_main( int argc, char** argv ) {
+    bool ret = false;
+    const char* file = NULL;
+    const char* log_json = NULL;
+    ALLEGRO_PATH* path = NULL;
+    sprite_t* sprite = NULL;
+    render_options_t options;
+
+    options.format = RENDER_Y4M;
+    options.fps = RENDER_FPS;
+    options.width = 0;
+    options.height = 0;
+    options.num_frames = 0;
+    options.output = NULL;
+
+    for ( int i = 2; i < argc; ++i ) {
+        const char* value = i + 1 < argc ? argv[ i + 1 ] : NULL;
+
+        if ( argv[ i ][ 0 ] != '-' ) {
+            file = argv[ i ];
+            continue;
+        }
+
+        if ( !value ) {
+            print_render_usage();
+            return 1;
+        }
+
+        if ( strcmp( argv[ i ], "--format" ) == 0 ) {
+            if ( strcmp( value, "raw" ) == 0 )
+                options.format = RENDER_RAW;
+            else if ( strcmp( value, "png" ) == 0 )
+                options.format = RENDER_PNG;
+            else if ( strcmp( value, "y4m" ) == 0 )
+                options.format = RENDER_Y4M;
+            else {
+                fprintf( stderr, "Unknown output format \"%s\".\n", value );
+                print_render_usage();
+                return 1;
+            }
+        }
+        else if ( strcmp( argv[ i ], "--fps" ) == 0 ) {
+            options.fps = atoi( value );
+        }
+        else if ( strcmp( argv[ i ], "--size" ) == 0 ) {
+            sscanf( value, "%ix%i", &options.width, &options.height );
+        }
+        else if ( strcmp( argv[ i ], "--frames" ) == 0 ) {
+            options.num_frames = atoi( value );
+        }
+        else if ( strcmp( argv[ i ], "--output" ) == 0 ) {
+            options.output = value;
+        }
+        else if ( strcmp( argv[ i ], "--log-json" ) == 0 ) {
+            log_json = value;
+        }
+        else if ( strcmp( argv[ i ], "--texture-format" ) == 0 ) {
+            int mode = parse_texture_format( value, -1 );
+            if ( mode < 0 ) {
+                print_render_usage();
+                return 1;
+            }
+            set_default_texture_format( mode );
+        }
+        else {
+            print_render_usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if ( !file ) {
+        print_render_usage();
+        return 1;
+    }
+
+    if ( !al_init() || !al_init_image_addon() ) {
+        fprintf( stderr, "Unable to initialize Allegro.\n" );
+        return 1;
+    }
+
+    /* Headless runs only ever log to stderr and files, never to dialogs */
+    if ( !log_init() ) {
+        fprintf( stderr, "Unable to start the logger.\n" );
+        return 1;
+    }
+    log_add_sink( LOG_SINK_STDERR, LOG_INFO, NULL );
+    if ( log_json && !log_add_sink( LOG_SINK_JSON, LOG_DEBUG, log_json ) )
+        print_err( "Unable to open the log file %s.", log_json );
+
+#ifdef _WIN32
+    /* Keep Windows from mangling the binary video stream */
+    _setmode( _fileno( stdout ), _O_BINARY );
+#endif
+
+    /* Everything is loaded into system memory, no display is created */
+    al_set_new_bitmap_flags( ALLEGRO_MEMORY_BITMAP );
+
+    path = al_create_path( file );
+    sprite = path ? load_sprite_file( path ) : NULL;
+
+    if ( sprite ) {
+        /* Decode the whole animation up front so every run is identical */
+        while ( stream_sprite_frames( sprite, 1.0 ) );
+        ret = render_offline( sprite, &options );
+        destroy_sprite( sprite );
+    }
+
+    if ( path )
+        al_destroy_path( path );
+
+    return ret ? 0 : 1;
+}
@@ -0,0 +1,467 @@
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "png_writer.h"
+
+/* Deflate parameters, see RFC 1951 */
+#define WINDOW_SIZE     32768
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define MIN_LOOKAHEAD   (MAX_MATCH + MIN_MATCH + 1)
+#define MAX_DISTANCE    (WINDOW_SIZE - MIN_LOOKAHEAD)
+#define HASH_BITS       15
+#define HASH_SIZE       (1 << HASH_BITS)
+#define MAX_CHAIN       64
+
+/* Compressed bytes are sent out in IDAT chunks of about this size */
+#define IDAT_SIZE       65536
+
+/******************************************************************************
+ *      STRUCTURES
+ ******************************************************************************/
+struct png_writer {
+    FILE* file;
+    bool failed;
+    int width;
+    int height;
+    int rows_written;
+    size_t row_bytes;
+    unsigned char* prev_row;    /* Unfiltered, zeroes before the first row */
+    unsigned char* filtered[ 2 ];
+
+    /* LZ77 state. The window holds two halves and slides down by one half
+     * whenever it fills up, like zlib. */
+    unsigned char window[ 2*WINDOW_SIZE ];
+    int head[ HASH_SIZE ];
+    int prev[ WINDOW_SIZE ];
+    int strstart;
+    int lookahead;
+    uint32_t adler_a;
+    uint32_t adler_b;
+
+    /* Bit output */
+    uint32_t bit_buffer;
+    int bit_count;
+    unsigned char idat[ IDAT_SIZE + 8 ];
+    size_t idat_size;
+};
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+static void deflate_input( png_writer_t*, const unsigned char*, size_t );
+static void deflate_step( png_writer_t* );
+static void flush_idat( png_writer_t* );
+
+/******************************************************************************
+ *      FIXED HUFFMAN CODES
+ ******************************************************************************/
+static const unsigned short length_base[ 29 ] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[ 29 ] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distance_base[ 30 ] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const unsigned char distance_extra[ 30 ] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static unsigned reverse_bits( unsigned code, int length ) {
+    unsigned reversed = 0;
+
+    for ( int i = 0; i < length; ++i, code >>= 1 )
+        reversed = (reversed << 1) | (code & 1);
+
+    return reversed;
+}
+
+/******************************************************************************
+ *      BIT OUTPUT
+ ******************************************************************************/
+static void put_bits( png_writer_t* png, unsigned value, int count ) {
+    png->bit_buffer |= (uint32_t)value << png->bit_count;
+    png->bit_count += count;
+
+    while ( png->bit_count >= 8 ) {
+        png->idat[ png->idat_size++ ] = (unsigned char)png->bit_buffer;
+        png->bit_buffer >>= 8;
+        png->bit_count -= 8;
+    }
+
+    if ( png->idat_size >= IDAT_SIZE )
+        flush_idat( png );
+}
+
+/* Huffman codes are packed starting from their most significant bit */
+static void put_code( png_writer_t* png, unsigned code, int length ) {
+    put_bits( png, reverse_bits( code, length ), length );
+}
+
+static void put_literal( png_writer_t* png, int value ) {
+    if ( value < 144 )
+        put_code( png, 0x30 + value, 8 );
+    else if ( value < 256 )
+        put_code( png, 0x190 + value - 144, 9 );
+    else if ( value < 280 )
+        put_code( png, value - 256, 7 );
+    else
+        put_code( png, 0xC0 + value - 280, 8 );
+}
+
+static void put_match( png_writer_t* png, int length, int distance ) {
+    int code = 28;
+
+    while ( length_base[ code ] > length )
+        --code;
+    put_literal( png, 257 + code );
+    put_bits( png, length - length_base[ code ], length_extra[ code ] );
+
+    code = 29;
+    while ( distance_base[ code ] > distance )
+        --code;
+    put_code( png, code, 5 );
+    put_bits( png, distance - distance_base[ code ], distance_extra[ code ] );
+}
+
+/******************************************************************************
+ *      CHUNK OUTPUT
+ ******************************************************************************/
+static uint32_t update_crc( uint32_t crc, const unsigned char* data, size_t size ) {
+    static uint32_t table[ 256 ];
+    static bool table_ready = false;
+
+    if ( !table_ready ) {
+        for ( uint32_t n = 0; n < 256; ++n ) {
+            uint32_t c = n;
+            for ( int k = 0; k < 8; ++k )
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[ n ] = c;
+        }
+        table_ready = true;
+    }
+
+    for ( size_t i = 0; i < size; ++i )
+        crc = table[ (crc ^ data[ i ]) & 0xFF ] ^ (crc >> 8);
+
+    return crc;
+}
+
+static void set_u32( unsigned char* data, uint32_t value ) {
+    data[ 0 ] = (unsigned char)(value >> 24);
+    data[ 1 ] = (unsigned char)(value >> 16);
+    data[ 2 ] = (unsigned char)(value >> 8);
+    data[ 3 ] = (unsigned char)value;
+}
+
+static void write_chunk(
+    png_writer_t* png, const char* type, const unsigned char* data, size_t size
+) {
+    unsigned char word[ 4 ];
+    uint32_t crc = update_crc( 0xFFFFFFFFu, (const unsigned char*)type, 4 );
+
+    crc = update_crc( crc, data, size ) ^ 0xFFFFFFFFu;
+
+    set_u32( word, (uint32_t)size );
+    png->failed |= fwrite( word, 4, 1, png->file ) != 1;
+    png->failed |= fwrite( type, 4, 1, png->file ) != 1;
+    if ( size )
+        png->failed |= fwrite( data, size, 1, png->file ) != 1;
+    set_u32( word, crc );
+    png->failed |= fwrite( word, 4, 1, png->file ) != 1;
+}
+
+static void flush_idat( png_writer_t* png ) {
+    if ( png->idat_size ) {
+        write_chunk( png, "IDAT", png->idat, png->idat_size );
+        png->idat_size = 0;
+    }
+}
+
+/******************************************************************************
+ *      DEFLATE
+ ******************************************************************************/
+static unsigned hash3( const unsigned char* data ) {
+    return ((data[ 0 ] << 10) ^ (data[ 1 ] << 5) ^ data[ 2 ]) & (HASH_SIZE - 1);
+}
+
+static void insert_string( png_writer_t* png, int pos ) {
+    unsigned h = hash3( png->window + pos );
+
+    png->prev[ pos & WINDOW_MASK ] = png->head[ h ];
+    png->head[ h ] = pos;
+}
+
+static int longest_match( png_writer_t* png, int match, int* distance ) {
+    const unsigned char* scan = png->window + png->strstart;
+    int max_length = png->lookahead < MAX_MATCH ? png->lookahead : MAX_MATCH;
+    int limit = png->strstart - MAX_DISTANCE;
+    int best = 0;
+
+    for ( int chain = 0; match >= 0 && match > limit && chain < MAX_CHAIN; ++chain ) {
+        const unsigned char* candidate = png->window + match;
+        int length = 0;
+
+        if ( candidate[ best ] == scan[ best ] ) {
+            while ( length < max_length && candidate[ length ] == scan[ length ] )
+                ++length;
+
+            if ( length > best ) {
+                best = length;
+                *distance = png->strstart - match;
+                if ( best >= max_length )
+                    break;
+            }
+        }
+
+        match = png->prev[ match & WINDOW_MASK ];
+    }
+
+    return best;
+}
+
+/* Encode whatever sits at strstart, either a match or a single literal */
+static void deflate_step( png_writer_t* png ) {
+    int length = 0;
+    int distance = 0;
+
+    if ( png->lookahead >= MIN_MATCH ) {
+        int match = png->head[ hash3( png->window + png->strstart ) ];
+
+        insert_string( png, png->strstart );
+        length = longest_match( png, match, &distance );
+    }
+
+    if ( length >= MIN_MATCH ) {
+        put_match( png, length, distance );
+
+        /* Every string inside the match goes into the hash chains as well */
+        for ( int i = 1; i < length; ++i ) {
+            if ( png->lookahead - i >= MIN_MATCH )
+                insert_string( png, png->strstart + i );
+        }
+        png->strstart += length;
+        png->lookahead -= length;
+    }
+    else {
+        put_literal( png, png->window[ png->strstart ] );
+        ++png->strstart;
+        --png->lookahead;
+    }
+}
+
+static void slide_window( png_writer_t* png ) {
+    memcpy( png->window, png->window + WINDOW_SIZE, WINDOW_SIZE );
+    png->strstart -= WINDOW_SIZE;
+
+    for ( int i = 0; i < HASH_SIZE; ++i )
+        png->head[ i ] = png->head[ i ] >= WINDOW_SIZE ? png->head[ i ] - WINDOW_SIZE : -1;
+    for ( int i = 0; i < WINDOW_SIZE; ++i )
+        png->prev[ i ] = png->prev[ i ] >= WINDOW_SIZE ? png->prev[ i ] - WINDOW_SIZE : -1;
+}
+
+static void deflate_input(
+    png_writer_t* png, const unsigned char* data, size_t size
+) {
+    /* Adler-32 of the uncompressed stream, for the zlib trailer */
+    for ( size_t i = 0; i < size; ++i ) {
+        png->adler_a = (png->adler_a + data[ i ]) % 65521;
+        png->adler_b = (png->adler_b + png->adler_a) % 65521;
+    }
+
+    while ( size > 0 ) {
+        size_t space = 2*WINDOW_SIZE - (png->strstart + png->lookahead);
+        size_t count = size < space ? size : space;
+
+        if ( space == 0 ) {
+            slide_window( png );
+            continue;
+        }
+
+        memcpy( png->window + png->strstart + png->lookahead, data, count );
+        png->lookahead += (int)count;
+        data += count;
+        size -= count;
+
+        /* Keep enough bytes ahead to find the longest possible match */
+        while ( png->lookahead >= MIN_LOOKAHEAD )
+            deflate_step( png );
+    }
+}
+
+/******************************************************************************
+ *      ROW FILTERING
+ ******************************************************************************/
+static int paeth( int a, int b, int c ) {
+    int p = a + b - c;
+    int pa = abs( p - a );
+    int pb = abs( p - b );
+    int pc = abs( p - c );
+
+    if ( pa <= pb && pa <= pc )
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/* Filter a row with the given type, returns the usual "sum of absolute
+ * differences" estimate of how well it will compress */
+static unsigned long filter_row(
+    int type, const unsigned char* row, const unsigned char* prev,
+    size_t size, unsigned char* out
+) {
+    unsigned long cost = 0;
+
+    out[ 0 ] = (unsigned char)type;
+    for ( size_t i = 0; i < size; ++i ) {
+        int left = i >= 4 ? row[ i - 4 ] : 0;
+        int up = prev[ i ];
+        int corner = i >= 4 ? prev[ i - 4 ] : 0;
+        int value = row[ i ];
+
+        switch ( type ) {
+            case 1: value -= left; break;
+            case 2: value -= up; break;
+            case 3: value -= (left + up) / 2; break;
+            case 4: value -= paeth( left, up, corner ); break;
+        }
+
+        out[ i + 1 ] = (unsigned char)value;
+        cost += abs( (signed char)out[ i + 1 ] );
+    }
+
+    return cost;
+}
+
+/******************************************************************************
+ *      PUBLIC INTERFACE
+ ******************************************************************************/
+png_writer_t* png_writer_open( const char* filename, int width, int height ) {
+    static const unsigned char signature[ 8 ] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    unsigned char ihdr[ 13 ];
+    png_writer_t* png = NULL;
+
+    if ( width < 1 || height < 1 )
+        return NULL;
+
+    png = (png_writer_t*)calloc( 1, sizeof( png_writer_t ) );
+    if ( !png )
+        return NULL;
+
+    png->width = width;
+    png->height = height;
+    png->row_bytes = (size_t)width*4;
+    png->prev_row = (unsigned char*)calloc( 1, png->row_bytes );
+    png->filtered[ 0 ] = (unsigned char*)malloc( png->row_bytes + 1 );
+    png->filtered[ 1 ] = (unsigned char*)malloc( png->row_bytes + 1 );
+    png->file = fopen( filename, "wb" );
+
+    if ( !png->prev_row || !png->filtered[ 0 ] || !png->filtered[ 1 ] || !png->file ) {
+        png->failed = true;
+        png_writer_close( png );
+        return NULL;
+    }
+
+    for ( int i = 0; i < HASH_SIZE; ++i )
+        png->head[ i ] = -1;
+    for ( int i = 0; i < WINDOW_SIZE; ++i )
+        png->prev[ i ] = -1;
+    png->adler_a = 1;
+
+    /* 8-bit RGBA, no interlacing */
+    set_u32( ihdr, width );
+    set_u32( ihdr + 4, height );
+    ihdr[ 8 ] = 8;
+    ihdr[ 9 ] = 6;
+    ihdr[ 10 ] = ihdr[ 11 ] = ihdr[ 12 ] = 0;
+
+    png->failed |= fwrite( signature, sizeof( signature ), 1, png->file ) != 1;
+    write_chunk( png, "IHDR", ihdr, sizeof( ihdr ) );
+
+    /* zlib header, then a single deflate block with the fixed codes */
+    png->idat[ png->idat_size++ ] = 0x78;
+    png->idat[ png->idat_size++ ] = 0x01;
+    put_bits( png, 1, 1 );
+    put_bits( png, 1, 2 );
+
+    return png;
+}
+
+bool png_writer_write_rows(
+    png_writer_t* png, const unsigned char* rows, int pitch, int num_rows
+) {
+    for ( int y = 0; y < num_rows && png->rows_written < png->height; ++y ) {
+        const unsigned char* row = rows + (ptrdiff_t)y*pitch;
+        int best = 0;
+        unsigned long best_cost = filter_row(
+            0, row, png->prev_row, png->row_bytes, png->filtered[ best ]
+        );
+
+        /* Adaptive filtering, keep whichever filter looks the smallest. Each
+         * attempt goes into the buffer which isn't holding the best one. */
+        for ( int type = 1; type < 5; ++type ) {
+            unsigned long cost = filter_row(
+                type, row, png->prev_row, png->row_bytes, png->filtered[ 1 - best ]
+            );
+
+            if ( cost < best_cost ) {
+                best_cost = cost;
+                best = 1 - best;
+            }
+        }
+
+        deflate_input( png, png->filtered[ best ], png->row_bytes + 1 );
+        memcpy( png->prev_row, row, png->row_bytes );
+        ++png->rows_written;
+    }
+
+    return !png->failed;
+}
+
+bool png_writer_close( png_writer_t* png ) {
+    bool ret = false;
+    unsigned char word[ 4 ];
+
+    if ( !png )
+        return false;
+
+    if ( png->file && !png->failed ) {
+        while ( png->lookahead > 0 )
+            deflate_step( png );
+
+        /* End of block, then pad out to a byte for the Adler-32 */
+        put_literal( png, 256 );
+        if ( png->bit_count > 0 )
+            put_bits( png, 0, 8 - png->bit_count );
+
+        set_u32( word, (png->adler_b << 16) | png->adler_a );
+        memcpy( png->idat + png->idat_size, word, 4 );
+        png->idat_size += 4;
+
+        flush_idat( png );
+        write_chunk( png, "IEND", NULL, 0 );
+        ret = !png->failed && png->rows_written == png->height;
+    }
+
+    if ( png->file )
+        ret = (fclose( png->file ) == 0) && ret;
+
+    free( png->prev_row );
+    free( png->filtered[ 0 ] );
+    free( png->filtered[ 1 ] );
+    free( png );
+
+    return ret;
+}
@@ -1,20 +1,35 @@
 
 #include <math.h>
+#include <stddef.h>
+#include <string.h>
 #include <allegro5/allegro.h>
-#include <allegro5/allegro_image.h>
 #include <allegro5/allegro_native_dialog.h>
 #include "sprite_viewer.h"
 #include "util_functions.h"
 #include "sheet_exporter.h"
+#include "collision_mask.h"
+#include "png_writer.h"
 
 static const char* BITMAP_EXPORT_FORMAT = ".png";
+static const char* MASK_EXPORT_FORMAT = ".mask";
+static const int SHEET_BAND_BYTES = 1 << 20;
+static int mask_threshold = MASK_DEFAULT_THRESHOLD;
 
 /******************************************************************************
  *      FORWARD DECLARATIONS
  ******************************************************************************/
+bool compose_sheet_band( const sprite_t*, int first_row, int num_rows, const unsigned char[ 4 ], unsigned char*, int pitch );
 bool save_sprite_sheet( ALLEGRO_PATH*, const sprite_t* );
+bool save_sheet_masks( ALLEGRO_PATH*, const sprite_t* );
 bool save_sheet_config( ALLEGRO_PATH*, const sprite_t* );
 
+/******************************************************************************
+ *      EXPORT SETTINGS
+ ******************************************************************************/
+void set_mask_threshold( int threshold ) {
+    mask_threshold = get_max_i( get_min_i( threshold, 255 ), 1 );
+}
+
 /******************************************************************************
  *      SPRITE SHEET EXPORT SETUP
  ******************************************************************************/
@@ -34,6 +49,16 @@ bool export_to_sheet( const sprite_t* sprite  ) {
         return false;
     }
     
+    /* Animations must finish decoding before all of their frames exist */
+    if ( sprite->stream ) {
+        al_show_native_message_box(
+            NULL, "Error", "The sprite is still loading.",
+            "Please wait for every frame to load before exporting a sheet.",
+            "Cancel", ALLEGRO_MESSAGEBOX_ERROR
+        );
+        return false;
+    }
+    
     /* Setup an initial path to save the sprite sheet */
     path = al_get_standard_path( ALLEGRO_EXENAME_PATH );
     if ( path == NULL )
@@ -70,8 +95,9 @@ bool export_to_sheet( const sprite_t* sprite  ) {
         return false;
     }
     
-    /* Save the sprite sheet and a corresponding config file */
+    /* Save the sprite sheet, its collision masks and a config file */
     ret =   !save_sprite_sheet( path, sprite )
+        ||  !save_sheet_masks( path, sprite )
         ||  !save_sheet_config( path, sprite );
     
     if ( !ret ) {
@@ -89,10 +115,81 @@ bool export_to_sheet( const sprite_t* sprite  ) {
 /******************************************************************************
  *      SPRITE SHEET EXPORTING -- SAVE THE SHEET
  ******************************************************************************/
+/* Blend the pieces of every frame which touch rows [first_row, first_row +
+ * num_rows) of the sheet over the background, the same way al_draw_bitmap()
+ * blends premultiplied pixels. Only the rows inside the band are locked, and
+ * bands don't overlap, so each texture is read back once over the export and
+ * never more than a band's worth at a time. */
+bool compose_sheet_band(
+    const sprite_t* sprite, int first_row, int num_rows,
+    const unsigned char background[ 4 ], unsigned char* band, int pitch
+) {
+    int sheet_width = sprite->width * sprite->num_frames;
+    
+    for ( int y = 0; y < num_rows; ++y ) {
+        unsigned char* dest = band + (ptrdiff_t)y*pitch;
+        for ( int x = 0; x < sheet_width; ++x )
+            memcpy( dest + x*4, background, 4 );
+    }
+    
+    for ( int i = 0; i < sprite->num_frames; ++i ) {
+        const sprite_frame_t* f = &sprite->frames[ i ];
+        
+        for ( ; f; f = get_next_piece( sprite, f ) ) {
+            ALLEGRO_BITMAP* texture = sprite->textures[ f->texture ];
+            int top = get_max_i( first_row, f->offset_y );
+            int bottom = get_min_i( first_row + num_rows, f->offset_y + f->height );
+            int width = get_min_i( f->width, al_get_bitmap_width( texture ) - f->x );
+            ALLEGRO_LOCKED_REGION* lock = NULL;
+            
+            /* Frames may be smaller than [SIZE], those are left blank */
+            bottom = get_min_i(
+                bottom, f->offset_y + al_get_bitmap_height( texture ) - f->y
+            );
+            if ( top >= bottom || width < 1 )
+                continue;
+            
+            lock = al_lock_bitmap_region(
+                texture, f->x, f->y + top - f->offset_y, width, bottom - top,
+                ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+            );
+            if ( !lock )
+                return false;
+            
+            for ( int y = top; y < bottom; ++y ) {
+                const unsigned char* src =
+                    (const unsigned char*)lock->data + (ptrdiff_t)(y - top)*lock->pitch;
+                unsigned char* dest = band + (ptrdiff_t)(y - first_row)*pitch
+                    + (ptrdiff_t)(i*sprite->width + f->offset_x)*4;
+                
+                for ( int x = 0; x < width*4; x += 4 ) {
+                    int inverse = 255 - src[ x + 3 ];
+                    for ( int c = 0; c < 4; ++c )
+                        dest[ x + c ] = (unsigned char)(
+                            src[ x + c ] + (dest[ x + c ]*inverse + 127)/255
+                        );
+                }
+            }
+            
+            al_unlock_bitmap( texture );
+        }
+    }
+    
+    return true;
+}
+
+/* The sheet is built a band of rows at a time straight from the frames'
+ * pixels and handed to the PNG encoder as it goes, so neither the whole
+ * sheet nor a render target is ever created */
 bool save_sprite_sheet( ALLEGRO_PATH* path, const sprite_t* sprite ) {
-    bool ret = false;
+    bool ret = true;
     const char* filename = NULL;
-    ALLEGRO_BITMAP* output = NULL;
+    int sheet_width = sprite->width * sprite->num_frames;
+    int pitch = sheet_width*4;
+    int band_rows = 0;
+    unsigned char background[ 4 ] = { 255, 255, 255, 255 };
+    unsigned char* band = NULL;
+    png_writer_t* png = NULL;
     
     al_set_path_extension( path, BITMAP_EXPORT_FORMAT );
     filename = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
@@ -107,31 +204,32 @@ bool save_sprite_sheet( ALLEGRO_PATH* path, const sprite_t* sprite ) {
         return false;
     }
     
-    /* Prepare the sprite sheet! */
-    output = al_create_bitmap(
-        sprite->width * sprite->num_frames, sprite->height
-    );
-    if ( !output ) {
+    /* Use white unless the user defined an alpha color */
+    if ( sprite->use_alpha )
+        al_unmap_rgb( sprite->alpha, &background[0], &background[1], &background[2] );
+    
+    /* Prepare the sprite sheet, a few rows at a time! */
+    band_rows = get_max_i( 1, get_min_i( sprite->height, SHEET_BAND_BYTES / pitch ) );
+    band = (unsigned char*)malloc( (size_t)pitch*band_rows );
+    if ( !band ) {
         print_err(
             "Unable to export the sprite sheet. Perhaps the images are too big?"
         );
         return false;
     }
     
-    /* Prep the new bitmap for drawing */
-    al_set_target_bitmap( output );
-    if ( sprite->use_alpha == false ) /* Use the alpha color defined by the user */
-        al_clear_to_color( al_map_rgba( 255, 255, 255, 255 ) ); /* white */
-    else /* use the alpha channel build into the image */
-        al_clear_to_color( sprite->alpha );
+    png = png_writer_open( filename, sheet_width, sprite->height );
+    ret = png != NULL;
     
-    /* Print the individual sprite frames to the sheet */
-    for ( int i = 0; i < sprite->num_frames; ++i ) {
-        al_draw_bitmap( sprite->bitmap[ i ], i*sprite->width, 0, 0 );
+    for ( int y = 0; y < sprite->height && ret; y += band_rows ) {
+        int num_rows = get_min_i( band_rows, sprite->height - y );
+        
+        ret = compose_sheet_band( sprite, y, num_rows, background, band, pitch )
+            && png_writer_write_rows( png, band, pitch, num_rows );
     }
     
-    /* Save the new sprite sheet to a file */
-    ret = al_save_bitmap ( filename, output );
+    ret = png_writer_close( png ) && ret;
+    free( band );
     
     if ( !ret ) {
         print_err(
@@ -142,13 +240,20 @@ bool save_sprite_sheet( ALLEGRO_PATH* path, const sprite_t* sprite ) {
         );
     }
     
-    /* Reset all draw commands to the current display */
-    al_set_target_backbuffer( al_get_current_display() );
-    al_destroy_bitmap( output );
-    
     return ret;
 }
 
+/******************************************************************************
+ *      SPRITE SHEET EXPORTING -- SAVE THE COLLISION MASKS
+ ******************************************************************************/
+bool save_sheet_masks( ALLEGRO_PATH* path, const sprite_t* sprite ) {
+    al_set_path_extension( path, MASK_EXPORT_FORMAT );
+    
+    return save_collision_masks(
+        al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP ), sprite, mask_threshold
+    );
+}
+
 /******************************************************************************
  *      SPRITE SHEET EXPORTING -- SAVE THE CONFIG
  ******************************************************************************/
@@ -204,5 +309,27 @@ bool save_sheet_config( ALLEGRO_PATH* path, const sprite_t* sprite ) {
         al_get_path_filename( path )
     );
     
+    /* Durations Section, only for frames with timings of their own */
+    for ( int i = 0; i < sprite->num_frames; ++i ) {
+        if ( sprite->frames[ i ].duration > 0 ) {
+            fprintf( file, "\n[DURATIONS]\n" );
+            for ( int j = 0; j < sprite->num_frames; ++j )
+                fprintf( file, "frame%i=%i\n", j, sprite->frames[ j ].duration );
+            break;
+        }
+    }
+    
+    /* Collision Mask Section */
+    al_set_path_extension( path, MASK_EXPORT_FORMAT );
+    fprintf( file,
+        "\n[MASKS]\n"\
+        "file=%s\n"\
+        "threshold=%i\n",
+        al_get_path_filename( path ), mask_threshold
+    );
+    
+    /* Leave the path naming the sheet image for the caller */
+    al_set_path_extension( path, BITMAP_EXPORT_FORMAT );
+    
     return fclose( file ) == 0;
 }
@@ -1,12 +1,104 @@
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "util_functions.h"
+#include "logger.h"
+#include "anim_decoder.h"
+#include "texture_format.h"
 #include "sprite_loader.h"
 
+/******************************************************************************
+        STRUCTURES
+******************************************************************************/
+/* How a sheet is cut into tiles which fit the largest allowed texture */
+typedef struct {
+    int width;          /* Size of the whole sheet */
+    int height;
+    int tile_size;
+    int tiles_x;
+    int tiles_y;
+    int num_pieces;     /* Extra pieces for frames which straddle tiles */
+} sheet_layout_t;
+
 /******************************************************************************
         FORWARD DECLARATIONS
 ******************************************************************************/
-bool load_sprite_sheet( ALLEGRO_PATH*, ALLEGRO_CONFIG*, sprite_t* );
+sprite_t* create_sprite( int max_frames, int max_textures, int max_pieces );
+int count_sprite_files( ALLEGRO_CONFIG* );
+int get_max_texture_size( void );
+ALLEGRO_BITMAP* load_sheet_image( ALLEGRO_PATH*, ALLEGRO_CONFIG* );
+void get_sheet_layout( ALLEGRO_BITMAP*, int num_frames, int width, int height, sheet_layout_t* );
+bool load_sprite_sheet( ALLEGRO_BITMAP*, const sheet_layout_t*, sprite_t* );
 bool load_sprite_images( ALLEGRO_PATH*, ALLEGRO_CONFIG*, sprite_t* );
+void set_sprite_frame( sprite_t*, int frame, int texture, int x, int y, int duration );
+void load_frame_durations( ALLEGRO_CONFIG*, sprite_t* );
+
+/******************************************************************************
+		SPRITE ALLOCATION
+******************************************************************************/
+/* The sprite, its textures, frames and pieces share one allocation:
+ * [ sprite_t | ALLEGRO_BITMAP* x max_textures | sprite_frame_t x max_frames
+ *   | sprite_frame_t x max_pieces ] */
+sprite_t* create_sprite( int max_frames, int max_textures, int max_pieces ) {
+    size_t space = SIZE_MAX - sizeof( sprite_t );
+    size_t textures_size = 0;
+    size_t frames_size = 0;
+    size_t pieces_size = 0;
+    sprite_t* sprite = NULL;
+    
+    if ( max_frames < 1 || max_textures < 1 || max_pieces < 0 )
+        return NULL;
+    
+    /* The counts can come from file headers, so the sizes mustn't wrap */
+    if ( (size_t)max_textures > space / sizeof( ALLEGRO_BITMAP* ) )
+        return NULL;
+    textures_size = max_textures*sizeof( ALLEGRO_BITMAP* );
+    space -= textures_size;
+    
+    if ( (size_t)max_frames > space / sizeof( sprite_frame_t ) )
+        return NULL;
+    frames_size = max_frames*sizeof( sprite_frame_t );
+    space -= frames_size;
+    
+    if ( (size_t)max_pieces > space / sizeof( sprite_frame_t ) )
+        return NULL;
+    pieces_size = max_pieces*sizeof( sprite_frame_t );
+    
+    sprite = (sprite_t*)calloc(
+        1, sizeof( sprite_t ) + textures_size + frames_size + pieces_size
+    );
+    if ( !sprite )
+        return NULL;
+    
+    sprite->textures = (ALLEGRO_BITMAP**)(sprite + 1);
+    sprite->frames = (sprite_frame_t*)((char*)sprite->textures + textures_size);
+    sprite->pieces = sprite->frames + max_frames;
+    sprite->max_frames = max_frames;
+    sprite->max_textures = max_textures;
+    sprite->max_pieces = max_pieces;
+    sprite->texture_format = get_default_texture_format();
+    sprite->stream = NULL;
+    
+    return sprite;
+}
+
+void set_sprite_frame(
+    sprite_t* sprite, int frame, int texture, int x, int y, int duration
+) {
+    sprite_frame_t* f = &sprite->frames[ frame ];
+    
+    f->texture = texture;
+    f->x = x;
+    f->y = y;
+    f->width = sprite->width;
+    f->height = sprite->height;
+    f->offset_x = 0;
+    f->offset_y = 0;
+    f->duration = duration;
+    f->next_piece = -1;
+}
 
 /******************************************************************************
 		LOADING SPRITE CONFIGURATION
@@ -20,7 +112,10 @@ sprite_t* load_sprite( ALLEGRO_PATH* path, ALLEGRO_CONFIG* cfg ) {
 	unsigned alpha_b    = 0;
 	int sprite_width    = 100;
 	int sprite_height   = 100;
+	int num_frames      = 0;
     sprite_t* sprite    = NULL;
+    ALLEGRO_BITMAP* sheet = NULL;
+    sheet_layout_t layout;
 	
 	is_sheet        = atoi( al_get_config_value( cfg, NULL, "is_sheet" ) );
 	frame_delay     = atoi( al_get_config_value( cfg, NULL, "frame_delay" ) );
@@ -43,24 +138,114 @@ sprite_t* load_sprite( ALLEGRO_PATH* path, ALLEGRO_CONFIG* cfg ) {
 		return false;
 	}
 	
-    sprite = NEW_OBJECT( sprite_t );
+	/* Sheets hold every frame in one texture, otherwise each file is a frame */
+	if ( is_sheet )
+		num_frames = atoi( al_get_config_value( cfg, NULL, "num_frames" ) );
+	else
+		num_frames = count_sprite_files( cfg );
+	
+	if ( num_frames < 1 ) {
+		print_err(
+			"The sprite has no frames. Please check the num_frames value "\
+			"and the [FILES] section of the config file.\n"
+		);
+		return NULL;
+	}
+	
+	/* Sheets are decoded first, their size decides how they're tiled */
+	if ( is_sheet ) {
+		sheet = load_sheet_image( path, cfg );
+		if ( !sheet )
+			return NULL;
+		
+		get_sheet_layout( sheet, num_frames, sprite_width, sprite_height, &layout );
+		sprite = create_sprite(
+			num_frames, layout.tiles_x*layout.tiles_y, layout.num_pieces
+		);
+	}
+	else {
+		sprite = create_sprite( num_frames, num_frames, 0 );
+	}
+	
+    if ( !sprite ) {
+        print_err( "Unable to allocate memory for %i sprite frames.", num_frames );
+        if ( sheet )
+            al_destroy_bitmap( sheet );
+        return NULL;
+    }
 	sprite->width = sprite_width;
 	sprite->height = sprite_height;
 	sprite->frame_delay = frame_delay;
 	sprite->alpha = al_map_rgb( alpha_r, alpha_g, alpha_b );
     sprite->is_sheet = is_sheet;
     sprite->use_alpha = (use_alpha > 0);
+    sprite->texture_format = parse_texture_format(
+        al_get_config_value( cfg, NULL, "texture_format" ),
+        get_default_texture_format()
+    );
 	
+    /* Every texture of the sprite is scanned by the same worker threads */
+    begin_texture_batch();
 	if ( is_sheet ) {
-		if ( !load_sprite_sheet( path, cfg, sprite ) ) {
-            FREE_MEMORY( sprite );
+		if ( !load_sprite_sheet( sheet, &layout, sprite ) ) {
+            destroy_sprite( sprite );
+            sprite = NULL;
         }
+        al_destroy_bitmap( sheet );
     }
 	else {
         if ( !load_sprite_images( path, cfg, sprite ) ) {
-            FREE_MEMORY( sprite );
+            destroy_sprite( sprite );
+            sprite = NULL;
         }
     }
+    end_texture_batch();
+    
+    if ( sprite )
+        load_frame_durations( cfg, sprite );
+    
+    return sprite;
+}
+
+/* Per-frame display times in milliseconds, written by the sheet exporter for
+ * animations. Frames without one use frame_delay. */
+void load_frame_durations( ALLEGRO_CONFIG* cfg, sprite_t* sprite ) {
+    char key[ 32 ];
+    
+    for ( int i = 0; i < sprite->num_frames; ++i ) {
+        const char* value = NULL;
+        
+        snprintf( key, sizeof( key ), "frame%i", i );
+        value = al_get_config_value( cfg, "DURATIONS", key );
+        if ( value )
+            sprite->frames[ i ].duration = get_max_i( atoi( value ), 0 );
+    }
+}
+
+/******************************************************************************
+		LOADING SPRITES FROM CONFIGS OR ANIMATIONS
+******************************************************************************/
+sprite_t* load_sprite_file( ALLEGRO_PATH* path ) {
+    const char* file    = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
+    ALLEGRO_CONFIG* cfg = NULL;
+    sprite_t* sprite    = NULL;
+    
+    /* Animated GIF and PNG files are loaded directly, without a config */
+    if ( anim_is_supported( file ) )
+        return load_animation( path );
+    
+    cfg = al_load_config_file( file );
+    if ( !cfg ) {
+        print_err(
+            "Unable to load the sprite's configuration data from %s. "\
+			"Please check that the file exists and is not corrupted.\n",
+            file
+        );
+        return NULL;
+    }
+    
+    sprite = load_sprite( path, cfg );
+    al_destroy_config( cfg );
     
     return sprite;
 }
@@ -68,35 +253,182 @@ sprite_t* load_sprite( ALLEGRO_PATH* path, ALLEGRO_CONFIG* cfg ) {
 /******************************************************************************
 		LOADING SPRITE DATA (single sprite sheet)
 ******************************************************************************/
-bool load_sprite_sheet(
-    ALLEGRO_PATH* path,
-    ALLEGRO_CONFIG* cfg,
-    sprite_t* sprite
-) {
+/* Largest texture the display can hold, or 0 when there is no limit */
+int get_max_texture_size( void ) {
+    ALLEGRO_DISPLAY* display = al_get_current_display();
+    
+    if ( !display || (al_get_new_bitmap_flags() & ALLEGRO_MEMORY_BITMAP) )
+        return 0;
+    
+    return al_get_display_option( display, ALLEGRO_MAX_BITMAP_SIZE );
+}
+
+/* Sheets are decoded into system memory, which has no size limit */
+ALLEGRO_BITMAP* load_sheet_image( ALLEGRO_PATH* path, ALLEGRO_CONFIG* cfg ) {
+    int flags = al_get_new_bitmap_flags();
+    ALLEGRO_BITMAP* sheet = NULL;
     ALLEGRO_CONFIG_ENTRY* cfg_iter = NULL;
     const char* filename =
         al_get_config_value(
             cfg, "FILES", al_get_first_config_entry( cfg, "FILES", &cfg_iter )
         );
     
+    if ( !filename ) {
+		print_err(
+			"No file name for a sprite sheet was listed under the "\
+			"[FILES] section of the config file.\n"
+		);
+        return NULL;
+    }
+    
     al_set_path_filename( path, filename );
-    filename            = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
-    sprite->num_frames  = atoi( al_get_config_value(cfg, NULL, "num_frames" ));
-    sprite->bitmap      = NEW_OBJECT( ALLEGRO_BITMAP* );
-    sprite->bitmap[0]   = al_load_bitmap( filename );
+    filename = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
+    
+    al_set_new_bitmap_flags( flags | ALLEGRO_MEMORY_BITMAP );
+    sheet = al_load_bitmap( filename );
+    al_set_new_bitmap_flags( flags );
     
-    if ( !sprite->bitmap[0] ) {
+    if ( !sheet ) {
         print_err(
             "Unable to allocate memory for %s. "\
             "Please ensure the input image is a reasonable size.",
             filename
         );
-        FREE_MEMORY( sprite->bitmap );
-        return false;
     }
     
+    return sheet;
+}
+
+/* Map one frame onto the tiles it covers. Returns the number of extra pieces
+ * it needs, and only fills in the frame and piece tables when "sprite" is
+ * given. Parts of a frame past the edge of the sheet are left out. */
+static int map_sheet_frame(
+    sprite_t* sprite, const sheet_layout_t* layout,
+    int frame, int width, int height
+) {
+    const int tile = layout->tile_size;
+    int x0 = frame*width;
+    int x1 = get_min_i( x0 + width, layout->width );
+    int y1 = get_min_i( height, layout->height );
+    int num_pieces = 0;
+    sprite_frame_t* piece = NULL;
+    
+    if ( sprite ) {
+        set_sprite_frame( sprite, frame, 0, 0, 0, 0 );
+        sprite->frames[ frame ].width = 0;
+        sprite->frames[ frame ].height = 0;
+    }
+    
+    if ( x0 >= x1 || y1 <= 0 )
+        return 0;
+    
+    for ( int ty = 0; ty <= (y1 - 1)/tile; ++ty ) {
+        for ( int tx = x0/tile; tx <= (x1 - 1)/tile; ++tx ) {
+            int left = get_max_i( x0, tx*tile );
+            int top = ty*tile;
+            
+            if ( !sprite ) {
+                ++num_pieces;
+                continue;
+            }
+            
+            if ( num_pieces++ == 0 ) {
+                piece = &sprite->frames[ frame ];
+            }
+            else {
+                piece->next_piece = sprite->num_pieces;
+                piece = &sprite->pieces[ sprite->num_pieces++ ];
+                piece->duration = 0;
+            }
+            
+            piece->texture = ty*layout->tiles_x + tx;
+            piece->x = left - tx*tile;
+            piece->y = 0;
+            piece->width = get_min_i( x1, (tx + 1)*tile ) - left;
+            piece->height = get_min_i( y1, (ty + 1)*tile ) - top;
+            piece->offset_x = left - x0;
+            piece->offset_y = top;
+            piece->next_piece = -1;
+        }
+    }
+    
+    return num_pieces - 1;
+}
+
+void get_sheet_layout(
+    ALLEGRO_BITMAP* sheet, int num_frames, int width, int height,
+    sheet_layout_t* layout
+) {
+    int max_size = get_max_texture_size();
+    
+    layout->width = al_get_bitmap_width( sheet );
+    layout->height = al_get_bitmap_height( sheet );
+    layout->tile_size = get_max_i( layout->width, layout->height );
+    if ( max_size > 0 )
+        layout->tile_size = get_min_i( layout->tile_size, max_size );
+    
+    layout->tiles_x = (layout->width + layout->tile_size - 1) / layout->tile_size;
+    layout->tiles_y = (layout->height + layout->tile_size - 1) / layout->tile_size;
+    layout->num_pieces = 0;
+    
+    for ( int i = 0; i < num_frames; ++i )
+        layout->num_pieces += map_sheet_frame( NULL, layout, i, width, height );
+}
+
+/* Cut the decoded sheet into textures no larger than the display allows.
+ * Most sheets fit and end up as a single tile. */
+bool load_sprite_sheet(
+    ALLEGRO_BITMAP* sheet,
+    const sheet_layout_t* layout,
+    sprite_t* sprite
+) {
+    const int tile = layout->tile_size;
+    ALLEGRO_LOCKED_REGION* lock = NULL;
+    
     if ( sprite->use_alpha )
-        al_convert_mask_to_alpha(sprite->bitmap[0], sprite->alpha);
+        al_convert_mask_to_alpha(sheet, sprite->alpha);
+    
+    lock = al_lock_bitmap(
+        sheet, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+    if ( !lock )
+        return false;
+    
+    for ( int ty = 0; ty < layout->tiles_y; ++ty ) {
+        for ( int tx = 0; tx < layout->tiles_x; ++tx ) {
+            const unsigned char* pixels = (const unsigned char*)lock->data
+                + (ptrdiff_t)ty*tile*lock->pitch + (ptrdiff_t)tx*tile*4;
+            ALLEGRO_BITMAP* texture = create_texture(
+                pixels, lock->pitch,
+                get_min_i( tile, layout->width - tx*tile ),
+                get_min_i( tile, layout->height - ty*tile ),
+                sprite->texture_format
+            );
+            
+            if ( !texture ) {
+                print_err(
+                    "Unable to allocate memory for tile %i of the sprite sheet.",
+                    sprite->num_textures + 1
+                );
+                al_unlock_bitmap( sheet );
+                return false;
+            }
+            sprite->textures[ sprite->num_textures++ ] = texture;
+        }
+    }
+    al_unlock_bitmap( sheet );
+    
+    if ( sprite->num_textures > 1 ) {
+        log_write( LOG_INFO,
+            "Split the %ix%i sprite sheet into %i tiles of up to %ix%i.",
+            layout->width, layout->height, sprite->num_textures, tile, tile
+        );
+    }
+    
+    /* Frames sit side by side along the sheet */
+    for ( int i = 0; i < sprite->max_frames; ++i )
+        map_sheet_frame( sprite, layout, i, sprite->width, sprite->height );
+    sprite->num_frames = sprite->max_frames;
     
     return true;
 }
@@ -109,63 +441,204 @@ bool load_sprite_images(
     ALLEGRO_CONFIG* cfg,
     sprite_t* sprite
 ) {
-	int num_files = 0;
 	int frame_iter = 0;
+	int num_mismatched = 0;
+	ALLEGRO_BITMAP* bitmap = NULL;
 	ALLEGRO_CONFIG_ENTRY* cfg_iter = NULL;
 	/* Just load the first section. Don't bother with config entries */
 	const char* sheet_file = al_get_first_config_entry(
 		cfg, "FILES", &cfg_iter
 	);
-	
-	if ( !sheet_file ) {
-		print_err(
-			"No file name for a sprite sheet was listed under the "\
-			"[FILES] section of the config file.\n"
-		);
-		return false;
-	}
-	
-	/* tabulate the number of sprite frames */
-    do {
-		++num_files;
-    }
-	while ( al_get_next_config_entry( &cfg_iter ) );
-    
-	/* return the cfg iterator to the first entry under [FILES] */
-	sheet_file = al_get_first_config_entry( cfg, "FILES", &cfg_iter );
-	
-	/* allocate enough space for each of the sprite frames */
-	sprite->bitmap = NEW_ARRAY(ALLEGRO_BITMAP*, num_files);
-	sprite->num_frames = num_files;
     
-	/* iterate through each index in sprite->bitmap[] and load the images */
-	while ( sheet_file ) {
+	/* iterate through each file under [FILES] and load the images */
+	while ( sheet_file && frame_iter < sprite->max_frames ) {
         const char* filename = al_get_config_value( cfg, "FILES", sheet_file );
         al_set_path_filename( path, filename );
-		sprite->bitmap[ frame_iter ] = al_load_bitmap(
-            al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP )
-        );
+		bitmap = al_load_bitmap( al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP ) );
 		
-		if ( !sprite->bitmap[ frame_iter ] ) {
+		if ( !bitmap ) {
 			print_err(
 				"Unable to load a sprite file \"%s\" referenced from "\
 				"the input config file. Aborting.\n",
                 al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP )
 			);
-			destroy_sprite( sprite );
 			return false;
 		}
+		sprite->textures[ frame_iter ] = bitmap;
+		sprite->num_textures = frame_iter + 1;
+		
+        /* Frames are drawn using [SIZE], so a mismatch would get cropped */
+        if (    al_get_bitmap_width( bitmap ) != sprite->width
+            ||  al_get_bitmap_height( bitmap ) != sprite->height
+        ) {
+            ++num_mismatched;
+            log_write( LOG_INFO,
+                "The sprite frame \"%s\" is %ix%i, but the config's [SIZE] is %ix%i.",
+                al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP ),
+                al_get_bitmap_width( bitmap ), al_get_bitmap_height( bitmap ),
+                sprite->width, sprite->height
+            );
+        }
+        
         /* Determine if the image should use an embedded alpha channel */
         if ( sprite->use_alpha )
-            al_convert_mask_to_alpha(sprite->bitmap[ frame_iter ], sprite->alpha);
+            al_convert_mask_to_alpha(bitmap, sprite->alpha);
         
+        sprite->textures[ frame_iter ] = compact_texture( bitmap, sprite->texture_format );
+        set_sprite_frame( sprite, frame_iter, frame_iter, 0, 0, 0 );
 		sheet_file = al_get_next_config_entry( &cfg_iter );
 		++frame_iter;
 	}
 	
+	sprite->num_frames = frame_iter;
+	
+    /* One warning per sprite, the frames themselves were logged as info */
+    if ( num_mismatched ) {
+        log_write( LOG_WARNING,
+            "%i of %i sprite frames don't match the config's [SIZE] of %ix%i.",
+            num_mismatched, frame_iter, sprite->width, sprite->height
+        );
+    }
 	return true;
 }
 
+/******************************************************************************
+		COUNTING SPRITE FILES
+******************************************************************************/
+int count_sprite_files( ALLEGRO_CONFIG* cfg ) {
+	int num_files = 0;
+	ALLEGRO_CONFIG_ENTRY* cfg_iter = NULL;
+	const char* entry = al_get_first_config_entry( cfg, "FILES", &cfg_iter );
+	
+	while ( entry ) {
+		++num_files;
+		entry = al_get_next_config_entry( &cfg_iter );
+	}
+	
+	return num_files;
+}
+
+/******************************************************************************
+		LOADING ANIMATED GIF/APNG FILES
+******************************************************************************/
+sprite_t* load_animation( ALLEGRO_PATH* path ) {
+    const char* filename = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
+    anim_decoder_t* anim = anim_open( filename );
+    sprite_t* sprite = NULL;
+    
+    if ( !anim ) {
+        print_err(
+            "Unable to read the animation in %s. "\
+            "Please check that it is a valid GIF or PNG file.\n",
+            filename
+        );
+        return NULL;
+    }
+    
+    /* Every frame of an animation is stored in a texture of its own */
+    sprite = create_sprite( anim_get_frame_count( anim ), anim_get_frame_count( anim ), 0 );
+    if ( !sprite ) {
+        if ( anim_get_frame_count( anim ) < 1 )
+            print_err( "The animation in %s has no frames.", filename );
+        else
+            print_err( "Unable to allocate memory for the frames in %s.", filename );
+        anim_close( anim );
+        return NULL;
+    }
+    sprite->is_sheet = false;
+    sprite->use_alpha = false;
+    sprite->frame_delay = 0;
+    sprite->width = anim_get_width( anim );
+    sprite->height = anim_get_height( anim );
+    sprite->alpha = al_map_rgb( 255, 255, 255 );
+    sprite->stream = anim;
+    
+    /* Frames are scanned by the same workers until the stream is closed */
+    begin_texture_batch();
+    
+    /* Only the first frame is needed before playback can begin */
+    stream_sprite_frames( sprite, 0.0 );
+    
+    if ( sprite->num_frames == 0 ) {
+        destroy_sprite( sprite );
+        return NULL;
+    }
+    
+    return sprite;
+}
+
+/******************************************************************************
+		STREAMING ANIMATION FRAMES
+******************************************************************************/
+static bool append_frame(
+    sprite_t* sprite, const unsigned char* canvas, int delay_ms
+) {
+    int frame = sprite->num_frames;
+    /* The decoder's canvas is already laid out as ABGR_8888_LE */
+    ALLEGRO_BITMAP* bitmap = create_texture(
+        canvas, sprite->width*4, sprite->width, sprite->height,
+        sprite->texture_format
+    );
+    
+    if ( !bitmap )
+        return false;
+    
+    sprite->textures[ sprite->num_textures ] = bitmap;
+    set_sprite_frame( sprite, frame, sprite->num_textures, 0, 0, delay_ms );
+    ++sprite->num_textures;
+    ++sprite->num_frames;
+    return true;
+}
+
+static void close_stream( sprite_t* sprite ) {
+    if ( !sprite->stream )
+        return;
+    
+    anim_close( sprite->stream );
+    sprite->stream = NULL;
+    end_texture_batch();
+}
+
+/* Decode frames until "time_limit" seconds have passed, at least one frame is
+ * always decoded. Returns false once the stream has finished or failed. */
+bool stream_sprite_frames( sprite_t* sprite, double time_limit ) {
+    const double start_time = al_get_time();
+    const unsigned char* canvas = NULL;
+    int delay_ms = 0;
+    int ret = ANIM_FRAME_READY;
+    
+    if ( !sprite->stream )
+        return false;
+    
+    do {
+        /* The frame table was sized from the file's own frame count */
+        if ( sprite->num_frames == sprite->max_frames ) {
+            ret = ANIM_FRAME_END;
+            break;
+        }
+        
+        ret = anim_next_frame( sprite->stream, &canvas, &delay_ms );
+        
+        if ( ret == ANIM_FRAME_READY && !append_frame( sprite, canvas, delay_ms ) )
+            ret = ANIM_FRAME_ERROR;
+    }
+    while ( ret == ANIM_FRAME_READY && al_get_time() - start_time < time_limit );
+    
+    if ( ret == ANIM_FRAME_READY )
+        return true;
+    
+    if ( ret == ANIM_FRAME_ERROR ) {
+        print_err(
+            "Unable to decode frame %i of the animation. "\
+            "Only the frames before it will be displayed.\n",
+            sprite->num_frames + 1
+        );
+    }
+    
+    close_stream( sprite );
+    return false;
+}
+
 /******************************************************************************
 		UNLOADING SPRITE DATA
 ******************************************************************************/
@@ -173,18 +646,12 @@ void destroy_sprite( sprite_t* sprite ) {
 	if ( !sprite )
 		return;
 	
-    if ( sprite->bitmap ) {
-        if ( sprite->is_sheet ) {
-            al_destroy_bitmap( sprite->bitmap[0] );
-        }
-        else {
-            for ( int i = 0; i < sprite->num_frames; ++i ) {
-                al_destroy_bitmap( sprite->bitmap[ i ] );
-            }
-        }
+    for ( int i = 0; i < sprite->num_textures; ++i ) {
+        al_destroy_bitmap( sprite->textures[ i ] );
     }
 	
-	free( sprite->bitmap );
+	close_stream( sprite );
+    /* The texture and frame tables are part of the same allocation */
     free( sprite );
     sprite = NULL;
 }
@@ -1,14 +1,21 @@
 
 /* Loading sprites using config files and sprite sheets */
 
+#include <stdio.h>
+#include <string.h>
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_image.h>
 #include <allegro5/allegro_native_dialog.h>
 
 #include "sprite_viewer.h"
 #include "sprite_loader.h"
+#include "offline_renderer.h"
+#include "asset_verifier.h"
+#include "stress_test.h"
 #include "util_functions.h"
+#include "logger.h"
 #include "sheet_exporter.h"
+#include "texture_format.h"
 
 /******************************************************************************
         GLOBAL VARIABLES
@@ -22,8 +29,7 @@ static const char* config_file = "viewer_settings.bin";
         FUNCTION PROTOTYPES
  ******************************************************************************/
 void init( ALLEGRO_DISPLAY**, int* fps );
-void do_main_loop( ALLEGRO_DISPLAY**, int fps, const sprite_t* sprite );
-void draw_sprite( ALLEGRO_DISPLAY*, const sprite_t*, int frame_num);
+void do_main_loop( ALLEGRO_DISPLAY**, int fps, sprite_t* sprite );
 void prevent_tiny_display( ALLEGRO_DISPLAY*, const sprite_t* );
 
 /******************************************************************************
@@ -42,6 +48,13 @@ void init( ALLEGRO_DISPLAY** display, int* fps ) {
     assert(al_init_image_addon());
     assert(al_install_keyboard());
 
+    /* Errors and results are shown in dialogs when running interactively,
+     * without the log thread they only ever reach stderr */
+    if (!log_init())
+        fprintf(stderr, "Unable to start the log thread.\n");
+    log_add_sink(LOG_SINK_STDERR, LOG_INFO, NULL);
+    log_add_sink(LOG_SINK_DIALOG, LOG_NOTICE, NULL);
+
     /* Load the program settings from config_file */
     cfg = al_load_config_file(config_file);
     if (cfg) {
@@ -49,6 +62,18 @@ void init( ALLEGRO_DISPLAY** display, int* fps ) {
         width   = atoi(al_get_config_value(cfg, NULL, "display_width"));
         height  = atoi(al_get_config_value(cfg, NULL, "display_height"));
         *fps    = atoi(al_get_config_value(cfg, NULL, "display_fps"));
+        /* Optional export settings */
+        if (al_get_config_value(cfg, NULL, "mask_threshold"))
+            set_mask_threshold(atoi(al_get_config_value(cfg, NULL, "mask_threshold")));
+        /* Optional texture format for sprites which don't set their own */
+        set_default_texture_format(parse_texture_format(
+            al_get_config_value(cfg, NULL, "texture_format"), TEXTURE_FORMAT_AUTO
+        ));
+        /* Optional log files */
+        if (al_get_config_value(cfg, NULL, "log_file"))
+            log_add_sink(LOG_SINK_FILE, LOG_DEBUG, al_get_config_value(cfg, NULL, "log_file"));
+        if (al_get_config_value(cfg, NULL, "log_json"))
+            log_add_sink(LOG_SINK_JSON, LOG_DEBUG, al_get_config_value(cfg, NULL, "log_json"));
         /* Verify that all the values were read in correctly from the config */
         width   = get_max_i(width, DISPLAY_WIDTH);
         height  = get_max_i(height, DISPLAY_HEIGHT);
@@ -64,7 +89,7 @@ void init( ALLEGRO_DISPLAY** display, int* fps ) {
 /******************************************************************************
         GAME LOOP
  ******************************************************************************/
-void do_main_loop( ALLEGRO_DISPLAY** win, int fps, const sprite_t* sprite ) {
+void do_main_loop( ALLEGRO_DISPLAY** win, int fps, sprite_t* sprite ) {
     bool running = true;
     bool redraw = true;
     int curr_frame = 0;
@@ -92,12 +117,12 @@ void do_main_loop( ALLEGRO_DISPLAY** win, int fps, const sprite_t* sprite ) {
                 /* Determine if a redraw should be performed */
             case ALLEGRO_EVENT_TIMER:
                 redraw = true;
-                if (frame_iter++ >= sprite->frame_delay) {
-                    if (++curr_frame >= sprite->num_frames) {
-                        curr_frame = 0;
-                    }
-                    frame_iter = 0;
-                }
+                /* Spend part of each tick decoding any frames still streaming in */
+                if (sprite->stream)
+                    stream_sprite_frames(sprite, 0.5 / fps);
+                step_sprite(sprite, fps, &curr_frame, &frame_iter);
+                /* Dialogs have to be opened from this thread */
+                log_show_dialogs();
                 break;
                 /* Send keyboard information to the input system */
             case ALLEGRO_EVENT_KEY_UP:
@@ -122,7 +147,10 @@ void do_main_loop( ALLEGRO_DISPLAY** win, int fps, const sprite_t* sprite ) {
             prevent_tiny_display( display, sprite );
             
             /* Drawing Ops go here */
-            draw_sprite( display, sprite, curr_frame );
+            draw_sprite(
+                al_get_display_width( display ), al_get_display_height( display ),
+                sprite, curr_frame
+            );
             al_flip_display();
             al_clear_to_color(al_map_rgb(255, 255, 255));
         }
@@ -132,6 +160,28 @@ void do_main_loop( ALLEGRO_DISPLAY** win, int fps, const sprite_t* sprite ) {
     al_destroy_event_queue(event_queue);
 }
 
+/******************************************************************************
+        FRAME TIMING
+ ******************************************************************************/
+int get_frame_delay( const sprite_t* sprite, int frame_num, int fps ) {
+    /* Convert per-frame delays from milliseconds into timer ticks */
+    int duration = sprite->frames[ frame_num ].duration;
+    
+    if ( duration > 0 )
+        return get_max_i( (duration*fps + 500)/1000 - 1, 0 );
+    
+    return sprite->frame_delay;
+}
+
+void step_sprite( const sprite_t* sprite, int fps, int* curr_frame, int* frame_iter ) {
+    if ((*frame_iter)++ >= get_frame_delay(sprite, *curr_frame, fps)) {
+        if (++(*curr_frame) >= sprite->num_frames) {
+            *curr_frame = 0;
+        }
+        *frame_iter = 0;
+    }
+}
+
 /******************************************************************************
         PREVENTING TINY DISPLAY
  ******************************************************************************/
@@ -146,28 +196,26 @@ void prevent_tiny_display( ALLEGRO_DISPLAY* display, const sprite_t* sprite ) {
 /******************************************************************************
         SPRITE_DRAWING
  ******************************************************************************/
-void draw_sprite( ALLEGRO_DISPLAY* display, const sprite_t* sprite, int frame_num ) {
-    float width = get_max_i(al_get_display_width(display), sprite->width);
-    float height = get_max_i(al_get_display_height(display), sprite->height);
-
-    if (width > height) width = height;
-    if (height > width) height = width;
+void draw_sprite(
+    int target_width, int target_height, const sprite_t* sprite, int frame_num
+) {
+    /* Every frame is a region of one of the sprite's textures, or several
+     * when it straddles the tiles of an oversized sheet */
+    const sprite_frame_t* f = &sprite->frames[ frame_num ];
+    /* Fit the whole sprite in the target, keeping its aspect ratio */
+    float scale = get_min_f(
+        (float)target_width / sprite->width, (float)target_height / sprite->height
+    );
     
-    /* Draw either a sprite image or a sprite sheet */
-    if ( sprite->is_sheet ) {
+    for ( ; f; f = get_next_piece( sprite, f ) ) {
+        if ( f->width < 1 || f->height < 1 )
+            continue;
+        
         al_draw_scaled_bitmap(
-            sprite->bitmap[ 0 ],
-            sprite->width*frame_num, 0,
-            sprite->width, sprite->height,
-            0.f, 0.f, width, height * (sprite->height / sprite->width),
-            0
-        );
-    }
-    else {
-        al_draw_scaled_bitmap(
-            sprite->bitmap[ frame_num ],
-            0.f, 0.f, sprite->width, sprite->height,
-            0.f, 0.f, width, height * (sprite->height / sprite->width),
+            sprite->textures[ f->texture ],
+            f->x, f->y, f->width, f->height,
+            f->offset_x*scale, f->offset_y*scale,
+            f->width*scale, f->height*scale,
             0
         );
     }
@@ -176,16 +224,22 @@ void draw_sprite( ALLEGRO_DISPLAY* display, const sprite_t* sprite, int frame_nu
 /******************************************************************************
         MAIN
  ******************************************************************************/
-int main() {
-    const char* file            = NULL;
+int main( int argc, char** argv ) {
     int target_fps              = DISPLAY_FPS;
-    ALLEGRO_CONFIG* cfg         = NULL;
     ALLEGRO_FILECHOOSER* dlg    = NULL;
     ALLEGRO_PATH* path          = NULL;
     sprite_t* sprite            = NULL;
     ALLEGRO_DISPLAY* display    = NULL;
     ALLEGRO_BITMAP* icon        = NULL;
     
+    /* Command-line modes set up Allegro and their own targets */
+    if ( argc > 1 && strcmp( argv[ 1 ], "--render" ) == 0 )
+        return render_main( argc, argv );
+    if ( argc > 1 && strcmp( argv[ 1 ], "--verify" ) == 0 )
+        return verify_main( argc, argv );
+    if ( argc > 1 && strcmp( argv[ 1 ], "--stress" ) == 0 )
+        return stress_main( argc, argv );
+    
     /* Initialize the display and set the icon */
     init( &display, &target_fps);
     icon = al_load_bitmap( "icon.png" );
@@ -194,7 +248,7 @@ int main() {
 
     /* Create and display a file-input dialog box */
     dlg = al_create_native_file_dialog(
-        NULL, "Choose Sprite Config File", "*.ini",
+        NULL, "Choose Sprite Config File", "*.ini;*.gif;*.png",
         ALLEGRO_FILECHOOSER_FILE_MUST_EXIST
     );
     assert(dlg);
@@ -210,31 +264,18 @@ int main() {
     /* Load the file path from the input file */
     path = al_create_path( al_get_native_file_dialog_path(dlg, 0) );
     al_destroy_native_file_dialog(dlg);
-    
-    /* Quit if no file was selected from the input dialog */
-    file = al_path_cstr( path, ALLEGRO_NATIVE_PATH_SEP );
-    assert( file );
-
-    cfg = al_load_config_file( file );
-    if (!cfg) {
-        print_err(
-            "Unable to load the sprite's configuration data from %s. "\
-			"Please check that the file exists and is not corrupted.\n",
-            file
-        );
-        al_destroy_path( path );
-        al_destroy_bitmap( icon );
-        al_destroy_display( display );
-        return 0;
-    }
-    
-    sprite = load_sprite( path, cfg );
+    assert( path );
+
+    sprite = load_sprite_file( path );
     if ( sprite )
         do_main_loop( &display, target_fps, sprite );
 
+    /* Flush the log so any errors left over are shown before exiting */
+    log_shutdown();
+    log_show_dialogs();
+
     al_destroy_path( path );
     if ( sprite ) destroy_sprite( sprite );
-    al_destroy_config( cfg );
     if ( icon ) al_destroy_bitmap( icon );
     al_destroy_display( display );
     return 0;
@@ -0,0 +1,444 @@
+
+#include <string.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_image.h>
+#include "sprite_viewer.h"
+#include "sprite_loader.h"
+#include "util_functions.h"
+#include "logger.h"
+#include "texture_format.h"
+#include "stress_test.h"
+
+static const int STRESS_INSTANCES = 10000;
+static const int STRESS_FRAMES = 600;
+static const int STRESS_WARMUP = 30;
+static const int STRESS_FPS = 60;
+static const int STRESS_WIDTH = 1280;
+static const int STRESS_HEIGHT = 720;
+
+/******************************************************************************
+ *      STRUCTURES
+ ******************************************************************************/
+typedef struct {
+    float x;
+    float y;
+    int curr_frame;
+    int frame_iter;
+} stress_instance_t;
+
+typedef struct {
+    const sprite_frame_t* piece;
+    float x;
+    float y;
+} stress_draw_t;
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+int count_frame_pieces( const sprite_t* );
+void place_instances( const sprite_t*, const stress_options_t*, stress_instance_t* );
+int build_draw_list( const sprite_t*, int fps, stress_instance_t*, int num_instances, stress_draw_t*, stress_draw_t*, int* counts );
+void get_frame_stats( double* times, int num_times, stress_results_t* );
+void write_stress_json( FILE*, const sprite_t*, const stress_options_t*, const stress_results_t* );
+
+/******************************************************************************
+ *      INSTANCE SETUP
+ ******************************************************************************/
+/* Most pieces any one frame is drawn from */
+int count_frame_pieces( const sprite_t* sprite ) {
+    int max_pieces = 1;
+
+    for ( int i = 0; i < sprite->num_frames; ++i ) {
+        int num_pieces = 0;
+        for ( const sprite_frame_t* f = &sprite->frames[ i ]; f; f = get_next_piece( sprite, f ) )
+            ++num_pieces;
+        max_pieces = get_max_i( max_pieces, num_pieces );
+    }
+
+    return max_pieces;
+}
+
+/* Scatter the instances over the target and stagger their animations, the
+ * layout only depends on the options so runs can be compared */
+void place_instances(
+    const sprite_t* sprite, const stress_options_t* options,
+    stress_instance_t* instances
+) {
+    unsigned seed = 12345;
+    int range_x = get_max_i( options->width - sprite->width, 1 );
+    int range_y = get_max_i( options->height - sprite->height, 1 );
+
+    for ( int i = 0; i < options->num_instances; ++i ) {
+        stress_instance_t* inst = &instances[ i ];
+
+        seed = seed*1103515245u + 12345u;
+        inst->x = (float)((seed >> 8) % range_x);
+        seed = seed*1103515245u + 12345u;
+        inst->y = (float)((seed >> 8) % range_y);
+
+        inst->curr_frame = i % sprite->num_frames;
+        inst->frame_iter = (i / sprite->num_frames)
+            % (get_frame_delay( sprite, inst->curr_frame, options->fps ) + 1);
+    }
+}
+
+/******************************************************************************
+ *      DRAW LIST
+ ******************************************************************************/
+/* Step every instance and list the pieces to draw, counting sorted by
+ * texture. Instances keep their order within each texture. Returns the
+ * number of entries in "sorted". */
+int build_draw_list(
+    const sprite_t* sprite, int fps,
+    stress_instance_t* instances, int num_instances,
+    stress_draw_t* unsorted, stress_draw_t* sorted, int* counts
+) {
+    int num_draws = 0;
+
+    memset( counts, 0, (sprite->num_textures + 1)*sizeof( int ) );
+
+    for ( int i = 0; i < num_instances; ++i ) {
+        stress_instance_t* inst = &instances[ i ];
+        const sprite_frame_t* f = &sprite->frames[ inst->curr_frame ];
+
+        for ( ; f; f = get_next_piece( sprite, f ) ) {
+            if ( f->width < 1 || f->height < 1 )
+                continue;
+
+            unsorted[ num_draws ].piece = f;
+            unsorted[ num_draws ].x = inst->x + f->offset_x;
+            unsorted[ num_draws ].y = inst->y + f->offset_y;
+            ++counts[ f->texture + 1 ];
+            ++num_draws;
+        }
+
+        step_sprite( sprite, fps, &inst->curr_frame, &inst->frame_iter );
+    }
+
+    /* Turn the counts into where each texture's run starts */
+    for ( int i = 0; i < sprite->num_textures; ++i )
+        counts[ i + 1 ] += counts[ i ];
+
+    for ( int i = 0; i < num_draws; ++i )
+        sorted[ counts[ unsorted[ i ].piece->texture ]++ ] = unsorted[ i ];
+
+    return num_draws;
+}
+
+/******************************************************************************
+ *      STATISTICS
+ ******************************************************************************/
+static int compare_times( const void* a, const void* b ) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double get_percentile( const double* sorted, int num_times, double p ) {
+    return sorted[ get_min_i( num_times - 1, (int)(p*(num_times - 1) + 0.5) ) ];
+}
+
+void get_frame_stats( double* times, int num_times, stress_results_t* results ) {
+    double total = 0.0;
+
+    qsort( times, num_times, sizeof( double ), compare_times );
+    for ( int i = 0; i < num_times; ++i )
+        total += times[ i ];
+
+    results->num_frames = num_times;
+    results->mean_ms = total / num_times;
+    results->p50_ms = get_percentile( times, num_times, 0.50 );
+    results->p90_ms = get_percentile( times, num_times, 0.90 );
+    results->p99_ms = get_percentile( times, num_times, 0.99 );
+    results->max_ms = times[ num_times - 1 ];
+}
+
+/******************************************************************************
+ *      STRESS TEST
+ ******************************************************************************/
+bool run_stress_test(
+    const sprite_t* sprite, const stress_options_t* options,
+    ALLEGRO_BITMAP* target, ALLEGRO_DISPLAY* display, stress_results_t* results
+) {
+    int num_frames = options->warmup_frames + options->num_frames;
+    int max_draws = options->num_instances * count_frame_pieces( sprite );
+    long total_draws = 0;
+    long total_batches = 0;
+    double total_ms = 0.0;
+    stress_instance_t* instances = NEW_ARRAY( stress_instance_t, options->num_instances );
+    stress_draw_t* unsorted = NEW_ARRAY( stress_draw_t, max_draws );
+    stress_draw_t* sorted = NEW_ARRAY( stress_draw_t, max_draws );
+    int* counts = NEW_ARRAY( int, sprite->num_textures + 1 );
+    double* times = NEW_ARRAY( double, options->num_frames );
+
+    if ( !instances || !unsorted || !sorted || !counts || !times ) {
+        print_err( "Unable to allocate memory for %i instances.", options->num_instances );
+        free( instances );
+        free( unsorted );
+        free( sorted );
+        free( counts );
+        free( times );
+        return false;
+    }
+
+    place_instances( sprite, options, instances );
+    al_set_target_bitmap( target );
+
+    for ( int frame = 0; frame < num_frames; ++frame ) {
+        double start_time = al_get_time();
+        int num_batches = 0;
+        int num_draws = build_draw_list(
+            sprite, options->fps, instances, options->num_instances,
+            unsorted, sorted, counts
+        );
+
+        al_clear_to_color( al_map_rgb( 255, 255, 255 ) );
+
+        /* Consecutive draws from one texture are sent to the GPU together */
+        al_hold_bitmap_drawing( true );
+        for ( int i = 0; i < num_draws; ++i ) {
+            const sprite_frame_t* f = sorted[ i ].piece;
+
+            if ( i == 0 || f->texture != sorted[ i - 1 ].piece->texture )
+                ++num_batches;
+
+            al_draw_bitmap_region(
+                sprite->textures[ f->texture ], f->x, f->y, f->width, f->height,
+                sorted[ i ].x, sorted[ i ].y, 0
+            );
+        }
+        al_hold_bitmap_drawing( false );
+
+        if ( display )
+            al_flip_display();
+
+        if ( frame >= options->warmup_frames ) {
+            double elapsed_ms = (al_get_time() - start_time) * 1000.0;
+
+            times[ frame - options->warmup_frames ] = elapsed_ms;
+            total_ms += elapsed_ms;
+            total_draws += num_draws;
+            total_batches += num_batches;
+        }
+    }
+
+    get_frame_stats( times, options->num_frames, results );
+    results->draws_per_frame = (double)total_draws / options->num_frames;
+    results->batches_per_frame = (double)total_batches / options->num_frames;
+    results->instances_per_ms =
+        (double)options->num_instances * options->num_frames / get_max_f( total_ms, 1e-6 );
+
+    free( instances );
+    free( unsorted );
+    free( sorted );
+    free( counts );
+    free( times );
+
+    return true;
+}
+
+/******************************************************************************
+ *      RESULTS
+ ******************************************************************************/
+void write_stress_json(
+    FILE* file, const sprite_t* sprite, const stress_options_t* options,
+    const stress_results_t* results
+) {
+    fprintf( file,
+        "{\"instances\":%i,\"frames\":%i,\"width\":%i,\"height\":%i,"\
+        "\"headless\":%s,\"sprite_frames\":%i,\"textures\":%i,"\
+        "\"frame_ms\":{\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f},"\
+        "\"draws_per_frame\":%.1f,\"batches_per_frame\":%.1f,"\
+        "\"instances_per_ms\":%.2f}\n",
+        options->num_instances, results->num_frames,
+        options->width, options->height, options->headless ? "true" : "false",
+        sprite->num_frames, sprite->num_textures,
+        results->mean_ms, results->p50_ms, results->p90_ms,
+        results->p99_ms, results->max_ms,
+        results->draws_per_frame, results->batches_per_frame,
+        results->instances_per_ms
+    );
+}
+
+static void print_stress_results(
+    const stress_options_t* options, const stress_results_t* results
+) {
+    print_msg(
+        "Drew %i instances for %i frames at %ix%i (%s)\n"\
+        "Frame time: mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n"\
+        "Draws per frame: %.1f, batches per frame: %.1f\n"\
+        "Instances per ms: %.2f\n",
+        options->num_instances, results->num_frames,
+        options->width, options->height,
+        options->headless ? "memory bitmap" : "display",
+        results->mean_ms, results->p50_ms, results->p90_ms,
+        results->p99_ms, results->max_ms,
+        results->draws_per_frame, results->batches_per_frame,
+        results->instances_per_ms
+    );
+}
+
+/******************************************************************************
+ *      COMMAND LINE
+ ******************************************************************************/
+static void print_stress_usage( void ) {
+    fprintf( stderr,
+        "Usage: sprite_viewer --stress <file> [options]\n"\
+        "  --instances N         Number of sprites drawn each frame (default: 10000)\n"\
+        "  --frames N            Frames to measure (default: 600)\n"\
+        "  --warmup N            Frames drawn before measuring (default: 30)\n"\
+        "  --fps N               Rate the sprites are animated at\n"\
+        "  --size WxH            Target size (default: 1280x720)\n"\
+        "  --headless            Draw to a memory bitmap, no display is created\n"\
+        "  --texture-format F    Texture format for sprites without their own\n"\
+        "                        (default: auto, exact pixels when headless)\n"\
+        "  --json FILE           Also write the results as JSON to FILE, or - for\n"\
+        "                        JSON only on stdout\n"\
+        "  --log-json FILE       Also write the log as JSON lines to FILE\n"
+    );
+}
+
+int stress_main( int argc, char** argv ) {
+    bool ret = false;
+    const char* file = NULL;
+    const char* log_json = NULL;
+    ALLEGRO_PATH* path = NULL;
+    ALLEGRO_DISPLAY* display = NULL;
+    ALLEGRO_BITMAP* target = NULL;
+    sprite_t* sprite = NULL;
+    stress_options_t options;
+    stress_results_t results;
+
+    options.num_instances = STRESS_INSTANCES;
+    options.num_frames = STRESS_FRAMES;
+    options.warmup_frames = STRESS_WARMUP;
+    options.fps = STRESS_FPS;
+    options.width = STRESS_WIDTH;
+    options.height = STRESS_HEIGHT;
+    options.headless = false;
+    options.json = NULL;
+
+    for ( int i = 2; i < argc; ++i ) {
+        const char* value = i + 1 < argc ? argv[ i + 1 ] : NULL;
+
+        if ( argv[ i ][ 0 ] != '-' ) {
+            file = argv[ i ];
+            continue;
+        }
+
+        if ( strcmp( argv[ i ], "--headless" ) == 0 ) {
+            options.headless = true;
+            continue;
+        }
+
+        if ( !value ) {
+            print_stress_usage();
+            return 1;
+        }
+
+        if ( strcmp( argv[ i ], "--instances" ) == 0 )
+            options.num_instances = atoi( value );
+        else if ( strcmp( argv[ i ], "--frames" ) == 0 )
+            options.num_frames = atoi( value );
+        else if ( strcmp( argv[ i ], "--warmup" ) == 0 )
+            options.warmup_frames = get_max_i( atoi( value ), 0 );
+        else if ( strcmp( argv[ i ], "--fps" ) == 0 )
+            options.fps = atoi( value );
+        else if ( strcmp( argv[ i ], "--size" ) == 0 )
+            sscanf( value, "%ix%i", &options.width, &options.height );
+        else if ( strcmp( argv[ i ], "--json" ) == 0 )
+            options.json = value;
+        else if ( strcmp( argv[ i ], "--log-json" ) == 0 )
+            log_json = value;
+        else if ( strcmp( argv[ i ], "--texture-format" ) == 0 ) {
+            int mode = parse_texture_format( value, -1 );
+            if ( mode < 0 ) {
+                print_stress_usage();
+                return 1;
+            }
+            set_default_texture_format( mode );
+        }
+        else {
+            print_stress_usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if ( !file || options.num_instances < 1 || options.num_frames < 1
+        || options.fps < 1 || options.width < 1 || options.height < 1
+    ) {
+        print_stress_usage();
+        return 1;
+    }
+
+    if ( !al_init() || !al_init_image_addon() ) {
+        fprintf( stderr, "Unable to initialize Allegro.\n" );
+        return 1;
+    }
+
+    if ( !log_init() ) {
+        fprintf( stderr, "Unable to start the logger.\n" );
+        return 1;
+    }
+    log_add_sink( LOG_SINK_STDERR, LOG_INFO, NULL );
+    if ( log_json && !log_add_sink( LOG_SINK_JSON, LOG_DEBUG, log_json ) )
+        print_err( "Unable to open the log file %s.", log_json );
+
+    if ( options.headless ) {
+        /* Everything lives in system memory, as in --render */
+        al_set_new_bitmap_flags( ALLEGRO_MEMORY_BITMAP );
+        target = al_create_bitmap( options.width, options.height );
+    }
+    else {
+        /* Don't let vsync cap the frame times */
+        al_set_new_display_option( ALLEGRO_VSYNC, 2, ALLEGRO_SUGGEST );
+        display = al_create_display( options.width, options.height );
+        target = display ? al_get_backbuffer( display ) : NULL;
+    }
+
+    if ( !target ) {
+        print_err( "Unable to create a %ix%i render target.", options.width, options.height );
+        return 1;
+    }
+
+    path = al_create_path( file );
+    sprite = path ? load_sprite_file( path ) : NULL;
+
+    if ( sprite ) {
+        /* Every frame has to exist before the instances are staggered */
+        while ( stream_sprite_frames( sprite, 1.0 ) );
+
+        ret = run_stress_test( sprite, &options, target, display, &results );
+        if ( ret ) {
+            if ( !options.json || strcmp( options.json, "-" ) != 0 )
+                print_stress_results( &options, &results );
+
+            if ( options.json && strcmp( options.json, "-" ) == 0 ) {
+                write_stress_json( stdout, sprite, &options, &results );
+            }
+            else if ( options.json ) {
+                FILE* json = fopen( options.json, "w" );
+                if ( json ) {
+                    write_stress_json( json, sprite, &options, &results );
+                    ret = fclose( json ) == 0;
+                }
+                if ( !json || !ret ) {
+                    print_err( "Unable to write the results to %s.", options.json );
+                    ret = false;
+                }
+            }
+        }
+        destroy_sprite( sprite );
+    }
+
+    if ( path )
+        al_destroy_path( path );
+    if ( options.headless )
+        al_destroy_bitmap( target );
+    if ( display )
+        al_destroy_display( display );
+
+    fflush( stdout );
+    return ret ? 0 : 1;
+}
@@ -0,0 +1,498 @@
+
+#include <stddef.h>
+#include <string.h>
+#include <allegro5/allegro.h>
+#include "sprite_viewer.h"
+#include "util_functions.h"
+#include "logger.h"
+#include "texture_format.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define SCAN_USE_SSE2
+    #include <emmintrin.h>
+#endif
+
+/* Images smaller than this are scanned on the calling thread */
+static const int SCAN_MIN_PIXELS = 256*256;
+#define SCAN_MAX_THREADS 4
+
+static int default_mode = TEXTURE_FORMAT_AUTO;
+
+/******************************************************************************
+ *      STRUCTURES
+ ******************************************************************************/
+/* OR of the bits which would be lost in each channel (R, G, B, A), plus
+ * whether any alpha wasn't 255 or wasn't 0/255 */
+typedef struct {
+    const unsigned char* data;
+    int pitch;
+    int width;
+    int first_row;
+    int last_row;
+    unsigned char loss_4[ 4 ];
+    unsigned char loss_5[ 4 ];
+    unsigned char loss_6[ 4 ];
+    bool translucent;
+    bool partial_alpha;
+} scan_band_t;
+
+/* Workers which help scan large images. They're started once for a whole
+ * batch of textures, see begin_texture_batch(). */
+typedef struct {
+    int num_batches;    /* begin_texture_batch() calls not yet ended */
+    int num_workers;
+    ALLEGRO_THREAD* workers[ SCAN_MAX_THREADS - 1 ];
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* work_ready;
+    ALLEGRO_COND* work_done;
+    scan_band_t* bands; /* Bands of the image being scanned, NULL when idle */
+    int num_bands;
+    int next_band;      /* First band no thread has taken yet */
+    int busy_bands;     /* Bands taken but not finished */
+} scan_pool_t;
+
+/******************************************************************************
+ *      FORWARD DECLARATIONS
+ ******************************************************************************/
+void scan_rows( scan_band_t* );
+void write_quantized( const unsigned char*, int width, int format, unsigned char* );
+const char* get_pixel_format_name( int format );
+
+static scan_pool_t pool;
+
+/******************************************************************************
+ *      CONFIG VALUES
+ ******************************************************************************/
+void set_default_texture_format( int mode ) {
+    default_mode = mode;
+}
+
+int get_default_texture_format( void ) {
+    return default_mode;
+}
+
+int parse_texture_format( const char* value, int fallback ) {
+    if ( !value )
+        return fallback;
+
+    if ( strcmp( value, "auto" ) == 0 )
+        return TEXTURE_FORMAT_AUTO;
+    if ( strcmp( value, "exact" ) == 0 )
+        return TEXTURE_FORMAT_EXACT;
+    if ( strcmp( value, "rgba8888" ) == 0 )
+        return TEXTURE_FORMAT_RGBA8888;
+    if ( strcmp( value, "rgb565" ) == 0 )
+        return TEXTURE_FORMAT_RGB565;
+    if ( strcmp( value, "rgba5551" ) == 0 )
+        return TEXTURE_FORMAT_RGBA5551;
+    if ( strcmp( value, "rgba4444" ) == 0 )
+        return TEXTURE_FORMAT_RGBA4444;
+
+    log_write( LOG_WARNING, "Unknown texture_format \"%s\", using the default.", value );
+    return fallback;
+}
+
+const char* get_pixel_format_name( int format ) {
+    switch ( format ) {
+        case ALLEGRO_PIXEL_FORMAT_RGB_565:   return "RGB565";
+        case ALLEGRO_PIXEL_FORMAT_RGBA_5551: return "RGBA5551";
+        case ALLEGRO_PIXEL_FORMAT_RGBA_4444: return "RGBA4444";
+        default:                             return "the default format";
+    }
+}
+
+/******************************************************************************
+ *      PIXEL SCANNING
+ ******************************************************************************/
+/* A channel value v survives a round trip through n bits when its low bits
+ * repeat its top bits, since Allegro widens n bits back to 8 by repeating
+ * them. So (v ^ (v >> n)) keeps the lost bits in its low 8-n bits. */
+void scan_rows( scan_band_t* band ) {
+    for ( int y = band->first_row; y < band->last_row; ++y ) {
+        const unsigned char* row = band->data + (ptrdiff_t)y*band->pitch;
+        int x = 0;
+
+#ifdef SCAN_USE_SSE2
+        {
+            const __m128i ones = _mm_set1_epi8( -1 );
+            const __m128i zero = _mm_setzero_si128();
+            __m128i loss_4 = zero;
+            __m128i loss_5 = zero;
+            __m128i loss_6 = zero;
+            __m128i not_opaque = zero;
+            __m128i not_binary = zero;
+            unsigned char lanes[ 5 ][ 16 ];
+
+            /* 4 pixels at a time. The 16-bit shifts only move bits across
+             * bytes in the high bits, which the masks throw away. */
+            for ( ; x + 4 <= band->width; x += 4 ) {
+                __m128i v = _mm_loadu_si128( (const __m128i*)( row + x*4 ) );
+                __m128i is_max = _mm_cmpeq_epi8( v, ones );
+                __m128i is_min = _mm_cmpeq_epi8( v, zero );
+
+                loss_4 = _mm_or_si128( loss_4, _mm_and_si128(
+                    _mm_xor_si128( v, _mm_srli_epi16( v, 4 ) ), _mm_set1_epi8( 0x0F )
+                ));
+                loss_5 = _mm_or_si128( loss_5, _mm_and_si128(
+                    _mm_xor_si128( v, _mm_srli_epi16( v, 5 ) ), _mm_set1_epi8( 0x07 )
+                ));
+                loss_6 = _mm_or_si128( loss_6, _mm_and_si128(
+                    _mm_xor_si128( v, _mm_srli_epi16( v, 6 ) ), _mm_set1_epi8( 0x03 )
+                ));
+                not_opaque = _mm_or_si128( not_opaque, _mm_andnot_si128( is_max, ones ) );
+                not_binary = _mm_or_si128(
+                    not_binary, _mm_andnot_si128( _mm_or_si128( is_max, is_min ), ones )
+                );
+            }
+
+            _mm_storeu_si128( (__m128i*)lanes[ 0 ], loss_4 );
+            _mm_storeu_si128( (__m128i*)lanes[ 1 ], loss_5 );
+            _mm_storeu_si128( (__m128i*)lanes[ 2 ], loss_6 );
+            _mm_storeu_si128( (__m128i*)lanes[ 3 ], not_opaque );
+            _mm_storeu_si128( (__m128i*)lanes[ 4 ], not_binary );
+
+            for ( int i = 0; i < 16; ++i ) {
+                band->loss_4[ i & 3 ] |= lanes[ 0 ][ i ];
+                band->loss_5[ i & 3 ] |= lanes[ 1 ][ i ];
+                band->loss_6[ i & 3 ] |= lanes[ 2 ][ i ];
+            }
+            for ( int i = 3; i < 16; i += 4 ) {
+                band->translucent |= lanes[ 3 ][ i ] != 0;
+                band->partial_alpha |= lanes[ 4 ][ i ] != 0;
+            }
+        }
+#endif
+
+        for ( ; x < band->width; ++x ) {
+            const unsigned char* p = row + x*4;
+
+            for ( int c = 0; c < 4; ++c ) {
+                band->loss_4[ c ] |= (p[ c ] ^ (p[ c ] >> 4)) & 0x0F;
+                band->loss_5[ c ] |= (p[ c ] ^ (p[ c ] >> 5)) & 0x07;
+                band->loss_6[ c ] |= (p[ c ] ^ (p[ c ] >> 6)) & 0x03;
+            }
+            band->translucent |= p[ 3 ] != 255;
+            band->partial_alpha |= p[ 3 ] != 255 && p[ 3 ] != 0;
+        }
+    }
+}
+
+/* Scan bands of the current image until none are left. Called with the
+ * pool's mutex held. */
+static void scan_pool_bands( void ) {
+    while ( pool.bands && pool.next_band < pool.num_bands ) {
+        scan_band_t* band = &pool.bands[ pool.next_band++ ];
+
+        ++pool.busy_bands;
+        al_unlock_mutex( pool.mutex );
+        scan_rows( band );
+        al_lock_mutex( pool.mutex );
+
+        if ( --pool.busy_bands == 0 && pool.next_band == pool.num_bands )
+            al_broadcast_cond( pool.work_done );
+    }
+}
+
+static void* scan_worker( ALLEGRO_THREAD* thread, void* arg ) {
+    (void)arg;
+
+    al_lock_mutex( pool.mutex );
+    while ( !al_get_thread_should_stop( thread ) ) {
+        scan_pool_bands();
+        al_wait_cond( pool.work_ready, pool.mutex );
+    }
+    al_unlock_mutex( pool.mutex );
+
+    return NULL;
+}
+
+void begin_texture_batch( void ) {
+    if ( pool.num_batches++ > 0 )
+        return;
+
+    if ( !pool.mutex ) {
+        pool.mutex = al_create_mutex();
+        pool.work_ready = al_create_cond();
+        pool.work_done = al_create_cond();
+        if ( !pool.mutex || !pool.work_ready || !pool.work_done )
+            return;
+    }
+
+    /* Without workers every image is simply scanned on the calling thread */
+    for ( int i = 0; i < SCAN_MAX_THREADS - 1; ++i ) {
+        ALLEGRO_THREAD* worker = al_create_thread( scan_worker, NULL );
+
+        if ( !worker )
+            break;
+        pool.workers[ pool.num_workers++ ] = worker;
+        al_start_thread( worker );
+    }
+}
+
+void end_texture_batch( void ) {
+    if ( pool.num_batches == 0 || --pool.num_batches > 0 )
+        return;
+
+    if ( pool.num_workers == 0 )
+        return;
+
+    al_lock_mutex( pool.mutex );
+    for ( int i = 0; i < pool.num_workers; ++i )
+        al_set_thread_should_stop( pool.workers[ i ] );
+    al_broadcast_cond( pool.work_ready );
+    al_unlock_mutex( pool.mutex );
+
+    for ( int i = 0; i < pool.num_workers; ++i ) {
+        al_join_thread( pool.workers[ i ], NULL );
+        al_destroy_thread( pool.workers[ i ] );
+    }
+    pool.num_workers = 0;
+}
+
+void scan_pixels(
+    const unsigned char* data, int pitch, int width, int height,
+    pixel_stats_t* stats
+) {
+    scan_band_t bands[ SCAN_MAX_THREADS ];
+    int num_bands = 1;
+    scan_band_t total;
+
+    if ( pool.num_workers > 0 && (long)width*height >= SCAN_MIN_PIXELS )
+        num_bands = get_min_i( pool.num_workers + 1, height );
+
+    memset( bands, 0, sizeof( bands ) );
+    for ( int i = 0; i < num_bands; ++i ) {
+        bands[ i ].data = data;
+        bands[ i ].pitch = pitch;
+        bands[ i ].width = width;
+        bands[ i ].first_row = (int)((long)height*i / num_bands);
+        bands[ i ].last_row = (int)((long)height*(i + 1) / num_bands);
+    }
+
+    if ( num_bands == 1 ) {
+        scan_rows( &bands[ 0 ] );
+    }
+    else {
+        /* Hand the bands to the workers and take some of them too */
+        al_lock_mutex( pool.mutex );
+        pool.bands = bands;
+        pool.num_bands = num_bands;
+        pool.next_band = 0;
+        pool.busy_bands = 0;
+        al_broadcast_cond( pool.work_ready );
+
+        scan_pool_bands();
+        while ( pool.busy_bands > 0 )
+            al_wait_cond( pool.work_done, pool.mutex );
+
+        pool.bands = NULL;
+        al_unlock_mutex( pool.mutex );
+    }
+
+    memset( &total, 0, sizeof( total ) );
+    for ( int i = 0; i < num_bands; ++i ) {
+        for ( int c = 0; c < 4; ++c ) {
+            total.loss_4[ c ] |= bands[ i ].loss_4[ c ];
+            total.loss_5[ c ] |= bands[ i ].loss_5[ c ];
+            total.loss_6[ c ] |= bands[ i ].loss_6[ c ];
+        }
+        total.translucent |= bands[ i ].translucent;
+        total.partial_alpha |= bands[ i ].partial_alpha;
+    }
+
+    stats->opaque = !total.translucent;
+    stats->binary_alpha = !total.partial_alpha;
+    stats->exact_565 =
+        !total.loss_5[ 0 ] && !total.loss_6[ 1 ] && !total.loss_5[ 2 ];
+    stats->exact_5551 =
+        !total.loss_5[ 0 ] && !total.loss_5[ 1 ] && !total.loss_5[ 2 ];
+    stats->exact_4444 =
+        !total.loss_4[ 0 ] && !total.loss_4[ 1 ] &&
+        !total.loss_4[ 2 ] && !total.loss_4[ 3 ];
+}
+
+/******************************************************************************
+ *      FORMAT SELECTION
+ ******************************************************************************/
+int choose_pixel_format( const pixel_stats_t* stats, int mode ) {
+    switch ( mode ) {
+        case TEXTURE_FORMAT_RGB565:
+            return ALLEGRO_PIXEL_FORMAT_RGB_565;
+        case TEXTURE_FORMAT_RGBA5551:
+            return ALLEGRO_PIXEL_FORMAT_RGBA_5551;
+        case TEXTURE_FORMAT_RGBA4444:
+            return ALLEGRO_PIXEL_FORMAT_RGBA_4444;
+        case TEXTURE_FORMAT_RGBA8888:
+            return ALLEGRO_PIXEL_FORMAT_ANY;
+        case TEXTURE_FORMAT_EXACT:
+            if ( stats->opaque && stats->exact_565 )
+                return ALLEGRO_PIXEL_FORMAT_RGB_565;
+            if ( stats->binary_alpha && stats->exact_5551 )
+                return ALLEGRO_PIXEL_FORMAT_RGBA_5551;
+            if ( stats->exact_4444 )
+                return ALLEGRO_PIXEL_FORMAT_RGBA_4444;
+            return ALLEGRO_PIXEL_FORMAT_ANY;
+        default:
+            /* Alpha is never rounded, only 4-bit alpha is exact or not at all */
+            if ( stats->opaque )
+                return ALLEGRO_PIXEL_FORMAT_RGB_565;
+            if ( stats->binary_alpha )
+                return ALLEGRO_PIXEL_FORMAT_RGBA_5551;
+            if ( stats->exact_4444 )
+                return ALLEGRO_PIXEL_FORMAT_RGBA_4444;
+            return ALLEGRO_PIXEL_FORMAT_ANY;
+    }
+}
+
+/******************************************************************************
+ *      TEXTURE CREATION
+ ******************************************************************************/
+/* Allegro truncates channels when it converts to a smaller format, so round
+ * each one to the nearest level first and write that level widened back to
+ * 8 bits. The truncation then lands on the rounded level. */
+void write_quantized(
+    const unsigned char* src, int width, int format, unsigned char* dest
+) {
+    static unsigned char lut[ 9 ][ 256 ];
+    static bool lut_ready = false;
+    int bits[ 4 ] = { 8, 8, 8, 8 };
+
+    if ( !lut_ready ) {
+        for ( int b = 1; b <= 8; ++b ) {
+            int levels = (1 << b) - 1;
+            for ( int v = 0; v < 256; ++v ) {
+                int q = (v*levels + 127) / 255;
+                lut[ b ][ v ] = (unsigned char)((q*255 + levels/2) / levels);
+            }
+        }
+        lut_ready = true;
+    }
+
+    switch ( format ) {
+        case ALLEGRO_PIXEL_FORMAT_RGB_565:
+            bits[ 0 ] = 5; bits[ 1 ] = 6; bits[ 2 ] = 5;
+            break;
+        case ALLEGRO_PIXEL_FORMAT_RGBA_5551:
+            bits[ 0 ] = bits[ 1 ] = bits[ 2 ] = 5; bits[ 3 ] = 1;
+            break;
+        case ALLEGRO_PIXEL_FORMAT_RGBA_4444:
+            bits[ 0 ] = bits[ 1 ] = bits[ 2 ] = bits[ 3 ] = 4;
+            break;
+    }
+
+    for ( int x = 0; x < width*4; x += 4 ) {
+        dest[ x + 0 ] = lut[ bits[ 0 ] ][ src[ x + 0 ] ];
+        dest[ x + 1 ] = lut[ bits[ 1 ] ][ src[ x + 1 ] ];
+        dest[ x + 2 ] = lut[ bits[ 2 ] ][ src[ x + 2 ] ];
+        dest[ x + 3 ] = lut[ bits[ 3 ] ][ src[ x + 3 ] ];
+    }
+}
+
+/* Memory bitmaps are only used for offline previews and benchmarks, which
+ * should see the source pixels, so auto mode leaves them as they are */
+static int get_texture_mode( int mode, bool memory_bitmap ) {
+    if ( mode == TEXTURE_FORMAT_AUTO && memory_bitmap )
+        return TEXTURE_FORMAT_RGBA8888;
+    return mode;
+}
+
+static ALLEGRO_BITMAP* create_texture_as(
+    const unsigned char* pixels, int pitch, int width, int height, int format
+) {
+    int old_format = al_get_new_bitmap_format();
+    ALLEGRO_BITMAP* bitmap = NULL;
+    ALLEGRO_LOCKED_REGION* lock = NULL;
+
+    al_set_new_bitmap_format( format );
+    bitmap = al_create_bitmap( width, height );
+    al_set_new_bitmap_format( old_format );
+
+    if ( !bitmap )
+        return NULL;
+
+    lock = al_lock_bitmap(
+        bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY
+    );
+    if ( !lock ) {
+        al_destroy_bitmap( bitmap );
+        return NULL;
+    }
+
+    for ( int y = 0; y < height; ++y ) {
+        write_quantized(
+            pixels + (ptrdiff_t)y*pitch, width, format,
+            (unsigned char*)lock->data + y*lock->pitch
+        );
+    }
+    al_unlock_bitmap( bitmap );
+
+    return bitmap;
+}
+
+ALLEGRO_BITMAP* create_texture(
+    const unsigned char* pixels, int pitch, int width, int height, int mode
+) {
+    pixel_stats_t stats;
+    int format = ALLEGRO_PIXEL_FORMAT_ANY;
+    ALLEGRO_BITMAP* bitmap = NULL;
+
+    mode = get_texture_mode(
+        mode, (al_get_new_bitmap_flags() & ALLEGRO_MEMORY_BITMAP) != 0
+    );
+    if ( mode != TEXTURE_FORMAT_RGBA8888 ) {
+        scan_pixels( pixels, pitch, width, height, &stats );
+        format = choose_pixel_format( &stats, mode );
+    }
+
+    if ( format != ALLEGRO_PIXEL_FORMAT_ANY )
+        bitmap = create_texture_as( pixels, pitch, width, height, format );
+
+    /* Not every driver has every format, fall back to the default one */
+    if ( !bitmap ) {
+        bitmap = create_texture_as(
+            pixels, pitch, width, height, al_get_new_bitmap_format()
+        );
+    }
+
+    return bitmap;
+}
+
+ALLEGRO_BITMAP* compact_texture( ALLEGRO_BITMAP* bitmap, int mode ) {
+    int width = al_get_bitmap_width( bitmap );
+    int height = al_get_bitmap_height( bitmap );
+    int format = ALLEGRO_PIXEL_FORMAT_ANY;
+    pixel_stats_t stats;
+    ALLEGRO_BITMAP* compact = NULL;
+    ALLEGRO_LOCKED_REGION* lock = NULL;
+
+    mode = get_texture_mode(
+        mode, (al_get_bitmap_flags( bitmap ) & ALLEGRO_MEMORY_BITMAP) != 0
+    );
+    if ( mode == TEXTURE_FORMAT_RGBA8888 )
+        return bitmap;
+
+    lock = al_lock_bitmap(
+        bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY
+    );
+    if ( !lock )
+        return bitmap;
+
+    scan_pixels( (const unsigned char*)lock->data, lock->pitch, width, height, &stats );
+    format = choose_pixel_format( &stats, mode );
+
+    if ( format != ALLEGRO_PIXEL_FORMAT_ANY ) {
+        compact = create_texture_as(
+            (const unsigned char*)lock->data, lock->pitch, width, height, format
+        );
+    }
+    al_unlock_bitmap( bitmap );
+
+    if ( !compact )
+        return bitmap;
+
+    log_write( LOG_DEBUG,
+        "Stored a %ix%i texture as %s.", width, height, get_pixel_format_name( format )
+    );
+    al_destroy_bitmap( bitmap );
+    return compact;
+}